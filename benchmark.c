@@ -1,32 +1,833 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 #include "strings.h"
+#include "sharded.h"
+#include "queue.h"
+#include "cache.h"
+#include "shared.h"
+#include "frozen.h"
+#include "optimize.h"
 #include "unsigned.h"
 
-int main() {
+#define BATCH_SIZE 1024
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Generate either sequential keys ("x1", "x2", ...) or keys which are
+// scattered across the hash space like real-world input
+static void make_key(char *buffer, uint32_t i, bool scattered) {
+    if (scattered) {
+        memcpy(buffer, "user-agent/", 11);
+        unsigned_string(buffer + 11, i * 2654435761u);
+    } else {
+        buffer[0] = 'x';
+        unsigned_string(buffer + 1, i);
+    }
+}
+
+static void benchmark(const char *name, uint32_t count, bool scattered) {
     struct strings *strings = strings_new();
     assert(strings);
 
-    char buffer[12] = {'x'};
-    uint32_t count = 5000000;
+    char buffer[32];
     size_t string_bytes = 0;
 
+    double start = now();
     for (uint32_t id = 1; id <= count; id++) {
-        unsigned_string(buffer + 1, id);
+        make_key(buffer, id, scattered);
         string_bytes += strlen(buffer);
         assert(strings_intern(strings, buffer) == id);
     }
+    double intern_time = now() - start;
 
     string_bytes += count;
     size_t allocated_bytes = strings_allocated_bytes(strings);
     size_t overhead = allocated_bytes - string_bytes;
     double overhead_per_string = (double)overhead / (double)count;
 
-    printf("Interned 5M unique strings\n");
-    printf("Overhead per string: %.1f bytes\n", overhead_per_string);
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, scattered);
+        assert(strings_lookup(strings, buffer) == id);
+    }
+    double lookup_time = now() - start;
+
+    // Strings looked up in ID order are read from the strings block in
+    // order, which hides the cost of confirming a match
+    start = now();
+    for (uint32_t i = 1; i <= count; i++) {
+        uint32_t id = (uint32_t)(((uint64_t)i * 2654435761u) % count) + 1;
+        make_key(buffer, id, scattered);
+        assert(strings_lookup(strings, buffer) == id);
+    }
+    double lookup_random_time = now() - start;
+
+    char batch_buffer[BATCH_SIZE][32];
+    const char *batch[BATCH_SIZE];
+    uint32_t batch_ids[BATCH_SIZE];
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        batch[i] = batch_buffer[i];
+    }
+
+    start = now();
+    for (uint32_t id = 1; id <= count; id += BATCH_SIZE) {
+        for (uint32_t i = 0; i < BATCH_SIZE; i++) {
+            make_key(batch_buffer[i], id + i, scattered);
+        }
+        strings_lookup_batch(strings, batch, NULL, batch_ids, BATCH_SIZE);
+        assert(batch_ids[0] == id);
+    }
+    double lookup_batch_time = now() - start;
+
+    struct strings *batched = strings_new();
+    assert(batched);
+    start = now();
+    for (uint32_t id = 1; id <= count; id += BATCH_SIZE) {
+        for (uint32_t i = 0; i < BATCH_SIZE; i++) {
+            make_key(batch_buffer[i], id + i, scattered);
+        }
+        assert(strings_intern_batch(batched, batch, NULL, batch_ids,
+                                    BATCH_SIZE));
+        assert(batch_ids[0] == id);
+    }
+    double intern_batch_time = now() - start;
+    strings_free(batched);
+
+    start = now();
+    for (uint32_t i = 1; i <= count; i++) {
+        uint32_t id = (uint32_t)(((uint64_t)i * 2654435761u) % count) + 1;
+        assert(strings_lookup_id(strings, id));
+    }
+    double lookup_id_time = now() - start;
+
+    uint32_t column[BATCH_SIZE];
+    uint32_t offsets[BATCH_SIZE + 1];
+    char column_data[BATCH_SIZE * 32];
+    start = now();
+    for (uint32_t i = 1; i <= count; i += BATCH_SIZE) {
+        for (uint32_t j = 0; j < BATCH_SIZE; j++) {
+            uint64_t scattered_id = (uint64_t)(i + j) * 2654435761u;
+            column[j] = (uint32_t)(scattered_id % count) + 1;
+        }
+        assert(strings_decode_column(strings, column, BATCH_SIZE, column_data,
+                                     sizeof(column_data), offsets) ==
+               BATCH_SIZE);
+    }
+    double decode_time = now() - start;
+
+    printf("Interned %uM unique %s strings\n", count / 1000000, name);
+    printf("  Overhead per string: %.1f bytes\n", overhead_per_string);
+    printf("  Intern: %.1fM strings/sec\n", count / intern_time / 1e6);
+    printf("  Intern (batches of %d): %.1fM strings/sec\n", BATCH_SIZE,
+           count / intern_batch_time / 1e6);
+    printf("  Lookup: %.1fM strings/sec\n", count / lookup_time / 1e6);
+    printf("  Lookup (random order): %.1fM strings/sec\n",
+           count / lookup_random_time / 1e6);
+    printf("  Lookup (batches of %d): %.1fM strings/sec\n", BATCH_SIZE,
+           count / lookup_batch_time / 1e6);
+    printf("  Lookup ID: %.1fM IDs/sec\n", count / lookup_id_time / 1e6);
+    printf("  Decode column: %.1fM IDs/sec\n", count / decode_time / 1e6);
+
+    strings_free(strings);
+}
+
+struct sharded_thread {
+    pthread_t thread;
+    struct strings_sharded *sharded;
+    uint32_t first;
+    uint32_t count;
+};
+
+static void *sharded_intern(void *arg) {
+    struct sharded_thread *thread = arg;
+    char buffer[32];
+    for (uint32_t i = 0; i < thread->count; i++) {
+        make_key(buffer, thread->first + i, true);
+        assert(strings_sharded_intern(thread->sharded, buffer));
+    }
+    return NULL;
+}
+
+// Intern unique strings into a sharded repository from several threads
+static void benchmark_sharded(uint32_t count, unsigned threads) {
+    struct strings_sharded *sharded = strings_sharded_new(64);
+    assert(sharded);
+    struct sharded_thread workers[64];
+    double start = now();
+    for (unsigned i = 0; i < threads; i++) {
+        workers[i].sharded = sharded;
+        workers[i].first = 1 + i * (count / threads);
+        workers[i].count = count / threads;
+        assert(!pthread_create(&workers[i].thread, NULL, sharded_intern,
+                               &workers[i]));
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        assert(!pthread_join(workers[i].thread, NULL));
+    }
+    double intern_time = now() - start;
+    assert(strings_sharded_count(sharded) == count / threads * threads);
+    printf("  Sharded intern (%u threads): %.1fM strings/sec\n", threads,
+           count / intern_time / 1e6);
+    strings_sharded_free(sharded);
+}
+
+#define QUEUE_WINDOW 256
+
+struct queue_thread {
+    pthread_t thread;
+    struct strings_queue *queue;
+    uint32_t first;
+    uint32_t count;
+};
+
+// Submit a window of requests, then wait for all of them
+static void *queue_produce(void *arg) {
+    struct queue_thread *thread = arg;
+    struct strings_request requests[QUEUE_WINDOW];
+    char keys[QUEUE_WINDOW][32];
+    for (uint32_t i = 0; i < thread->count; i += QUEUE_WINDOW) {
+        for (uint32_t j = 0; j < QUEUE_WINDOW; j++) {
+            make_key(keys[j], thread->first + i + j, true);
+            while (!strings_queue_submit(thread->queue, &requests[j], keys[j],
+                                         strlen(keys[j]))) {
+                sched_yield();
+            }
+        }
+        for (uint32_t j = 0; j < QUEUE_WINDOW; j++) {
+            assert(strings_queue_wait(thread->queue, &requests[j]));
+        }
+    }
+    return NULL;
+}
+
+static int compare_doubles(const void *a_, const void *b_) {
+    double a = *(const double *)a_, b = *(const double *)b_;
+    return a < b ? -1 : a > b;
+}
+
+// Intern strings from several producer threads through an ingestion queue
+static void benchmark_queue(uint32_t count, unsigned threads) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    struct strings_queue *queue = strings_queue_new(strings, 4096);
+    assert(queue);
+    struct queue_thread producers[64];
+    uint32_t per_thread = count / threads / QUEUE_WINDOW * QUEUE_WINDOW;
+    double start = now();
+    for (unsigned i = 0; i < threads; i++) {
+        producers[i].queue = queue;
+        producers[i].first = 1 + i * per_thread;
+        producers[i].count = per_thread;
+        assert(!pthread_create(&producers[i].thread, NULL, queue_produce,
+                               &producers[i]));
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        assert(!pthread_join(producers[i].thread, NULL));
+    }
+    double intern_time = now() - start;
+    strings_queue_free(queue);
+    assert(strings_count(strings) == per_thread * threads);
+    printf("  Queued intern (%u producers): %.1fM strings/sec\n", threads,
+           per_thread * threads / intern_time / 1e6);
+    strings_free(strings);
+}
+
+// Measure the round trip of interning one string at a time through a queue
+static void benchmark_queue_latency(uint32_t count) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    struct strings_queue *queue = strings_queue_new(strings, 4096);
+    assert(queue);
+    double *latencies = malloc(sizeof(*latencies) * count);
+    assert(latencies);
+    char buffer[32];
+    double total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        make_key(buffer, i + 1, true);
+        double start = now();
+        assert(strings_queue_intern(queue, buffer, strlen(buffer)) == i + 1);
+        latencies[i] = now() - start;
+        total += latencies[i];
+    }
+    qsort(latencies, count, sizeof(*latencies), compare_doubles);
+    printf("  Queued intern latency: %.1fus mean, %.1fus p99\n",
+           total / count * 1e6, latencies[count / 100 * 99] * 1e6);
+    free(latencies);
+    strings_queue_free(queue);
+    strings_free(strings);
+}
+
+// Generate a skewed stream of key ranks, where 1% of count keys account for
+// 80% of the stream
+static uint32_t *skewed_ranks(uint32_t count, uint32_t n) {
+    uint32_t *ranks = malloc(sizeof(*ranks) * n);
+    assert(ranks);
+    uint64_t state = 88172645463325252ULL;
+    for (uint32_t i = 0; i < n; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint32_t random = (uint32_t)(state >> 32);
+        if (random % 5) {
+            ranks[i] = 1 + (uint32_t)(state % (count / 100));
+        } else {
+            ranks[i] = 1 + (uint32_t)(state % count);
+        }
+    }
+    return ranks;
+}
+
+// Intern a skewed stream of keys with and without a hot-key cache
+static void benchmark_cache(uint32_t count, uint32_t n, size_t size) {
+    uint32_t *ranks = skewed_ranks(count, n);
+    char buffer[32];
+
+    struct strings *strings = strings_new();
+    assert(strings);
+    double start = now();
+    for (uint32_t i = 0; i < n; i++) {
+        make_key(buffer, ranks[i], true);
+        assert(strings_intern_len(strings, buffer, strlen(buffer)));
+    }
+    double intern_time = now() - start;
+    strings_free(strings);
+
+    strings = strings_new();
+    assert(strings);
+    struct strings_cache *cache = strings_cache_new(strings, size);
+    assert(cache);
+    start = now();
+    for (uint32_t i = 0; i < n; i++) {
+        make_key(buffer, ranks[i], true);
+        assert(strings_cache_intern(cache, buffer, strlen(buffer)));
+    }
+    double cache_time = now() - start;
+    double hit_rate = 100.0 * strings_cache_hits(cache) / (double)n;
+    strings_cache_free(cache);
+    strings_free(strings);
+
+    // The same, with the repository behind a mutex
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    strings = strings_new();
+    assert(strings);
+    start = now();
+    for (uint32_t i = 0; i < n; i++) {
+        make_key(buffer, ranks[i], true);
+        pthread_mutex_lock(&lock);
+        assert(strings_intern_len(strings, buffer, strlen(buffer)));
+        pthread_mutex_unlock(&lock);
+    }
+    double locked_time = now() - start;
+    strings_free(strings);
+
+    strings = strings_new();
+    assert(strings);
+    cache = strings_cache_new(strings, size);
+    assert(cache);
+    start = now();
+    for (uint32_t i = 0; i < n; i++) {
+        make_key(buffer, ranks[i], true);
+        size_t len = strlen(buffer);
+        uint32_t id = strings_cache_get(cache, buffer, len);
+        if (!id) {
+            pthread_mutex_lock(&lock);
+            id = strings_intern_len(strings, buffer, len);
+            pthread_mutex_unlock(&lock);
+            strings_cache_put(cache, buffer, len, id);
+        }
+        assert(id);
+    }
+    double locked_cache_time = now() - start;
+
+    printf("Interned %uM skewed strings (%.1fM unique)\n", n / 1000000,
+           strings_count(strings) / 1e6);
+    printf("  Intern: %.1fM strings/sec\n", n / intern_time / 1e6);
+    printf("  Intern (cache of %zu): %.1fM strings/sec, %.1f%% hits\n", size,
+           n / cache_time / 1e6, hit_rate);
+    printf("  Intern (with a mutex): %.1fM strings/sec\n",
+           n / locked_time / 1e6);
+    printf("  Intern (with a mutex and cache): %.1fM strings/sec\n",
+           n / locked_cache_time / 1e6);
+    strings_cache_free(cache);
+    strings_free(strings);
+    free(ranks);
+}
+
+// Save a repository and map it back in
+static void benchmark_save_load(uint32_t count) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    char buffer[32];
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_intern(strings, buffer) == id);
+    }
+    char path[] = "/tmp/intern-benchmark-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    double start = now();
+    assert(strings_save(strings, fd));
+    double save_time = now() - start;
+    close(fd);
+    strings_free(strings);
+
+    start = now();
+    strings = strings_load_mmap(path);
+    assert(strings);
+    double load_time = now() - start;
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_lookup(strings, buffer) == id);
+    }
+    double lookup_time = now() - start;
+    strings_free(strings);
+    unlink(path);
+
+    printf("Saved and loaded %uM unique scattered strings\n", count / 1000000);
+    printf("  Save: %.1fms\n", save_time * 1e3);
+    printf("  Load: %.3fms\n", load_time * 1e3);
+    printf("  Lookup after load: %.1fM strings/sec\n",
+           count / lookup_time / 1e6);
+}
+
+static void benchmark_shared(uint32_t count) {
+    char name[32];
+    snprintf(name, sizeof(name), "/intern-benchmark-%d", (int)getpid());
+    struct strings_shared *shared = strings_shared_create(name, count,
+                                                          (size_t)count * 32);
+    assert(shared);
+    char buffer[32];
+    double start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_shared_intern(shared, buffer) == id);
+    }
+    double intern_time = now() - start;
+    start = now();
+    struct strings_shared *reader = strings_shared_open(name);
+    assert(reader);
+    double open_time = now() - start;
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_shared_lookup(reader, buffer) == id);
+    }
+    double lookup_time = now() - start;
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        assert(strings_shared_lookup_id(reader, id));
+    }
+    double lookup_id_time = now() - start;
+    strings_shared_close(reader);
+    strings_shared_close(shared);
+    strings_shared_unlink(name);
+
+    printf("Interned %uM unique scattered strings in shared memory\n",
+           count / 1000000);
+    printf("  Intern: %.1fM strings/sec\n", count / intern_time / 1e6);
+    printf("  Open: %.3fms\n", open_time * 1e3);
+    printf("  Lookup from another mapping: %.1fM strings/sec\n",
+           count / lookup_time / 1e6);
+    printf("  Lookup ID from another mapping: %.1fM IDs/sec\n",
+           count / lookup_id_time / 1e6);
+}
+
+static void benchmark_file(uint32_t count) {
+    char path[] = "/tmp/intern-benchmark-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    struct strings *strings = strings_new_file(fd);
+    assert(strings);
+    close(fd);
+    char buffer[32];
+    double start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_intern(strings, buffer) == id);
+    }
+    double intern_time = now() - start;
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_lookup(strings, buffer) == id);
+    }
+    double lookup_time = now() - start;
+    strings_free(strings);
+
+    printf("Interned %uM unique scattered strings into a file\n",
+           count / 1000000);
+    printf("  Intern: %.1fM strings/sec\n", count / intern_time / 1e6);
+    printf("  Lookup: %.1fM strings/sec\n", count / lookup_time / 1e6);
+}
+
+static void benchmark_frozen(uint32_t count) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    char buffer[32];
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_intern(strings, buffer) == id);
+    }
+    size_t bytes = strings_allocated_bytes(strings);
+    double start = now();
+    struct strings_frozen *frozen = strings_freeze(strings);
+    assert(frozen);
+    double freeze_time = now() - start;
+    strings_free(strings);
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_frozen_lookup(frozen, buffer) == id);
+    }
+    double lookup_time = now() - start;
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        buffer[0] = '!';
+        assert(!strings_frozen_lookup(frozen, buffer));
+    }
+    double missing_time = now() - start;
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        assert(strings_frozen_lookup_id(frozen, id));
+    }
+    double lookup_id_time = now() - start;
+
+    printf("Froze %uM unique scattered strings\n", count / 1000000);
+    printf("  Freeze: %.1fms\n", freeze_time * 1e3);
+    printf("  Bytes per string: %.1f (%.1f before freezing)\n",
+           (double)strings_frozen_allocated_bytes(frozen) / count,
+           (double)bytes / count);
+    printf("  Lookup: %.1fM strings/sec\n", count / lookup_time / 1e6);
+    printf("  Lookup (missing): %.1fM strings/sec\n",
+           count / missing_time / 1e6);
+    printf("  Lookup ID: %.1fM IDs/sec\n", count / lookup_id_time / 1e6);
+    strings_frozen_free(frozen);
+}
+
+// Generate URL-like keys, where groups of keys share a long prefix
+static void make_url(char *buffer, uint32_t i) {
+    memcpy(buffer, "https://example.com/api/v2/accounts/", 36);
+    char *ptr = buffer + 36;
+    ptr += unsigned_string(ptr, (i / 16) * 2654435761u);
+    memcpy(ptr, "/metrics/", 9);
+    unsigned_string(ptr + 9, i % 16);
+}
+
+static void benchmark_front_coded(uint32_t count) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    char buffer[64];
+    size_t string_bytes = 0;
+    for (uint32_t id = 1; id <= count; id++) {
+        make_url(buffer, id);
+        string_bytes += strlen(buffer) + 1;
+        assert(strings_intern(strings, buffer) == id);
+    }
+    struct strings *sorted = strings_sort(strings, NULL);
+    assert(sorted);
+    strings_free(strings);
+    struct strings_frozen *frozen = strings_freeze(sorted);
+    assert(frozen);
+    double start = now();
+    struct strings_frozen *front_coded = strings_freeze_front_coded(sorted);
+    assert(front_coded);
+    double freeze_time = now() - start;
+    strings_free(sorted);
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_url(buffer, id);
+        assert(strings_frozen_lookup(front_coded, buffer));
+    }
+    double lookup_time = now() - start;
+    start = now();
+    for (uint32_t i = 1; i <= count; i++) {
+        uint32_t id = (uint32_t)((uint64_t)i * 2654435761u % count) + 1;
+        assert(strings_frozen_lookup_id(front_coded, id));
+    }
+    double lookup_id_time = now() - start;
+    size_t plain_bytes = strings_frozen_allocated_bytes(frozen);
+    size_t front_coded_bytes = strings_frozen_allocated_bytes(front_coded);
+    strings_frozen_free(frozen);
+    strings_frozen_free(front_coded);
+
+    printf("Froze %uM sorted URLs with front coding\n", count / 1000000);
+    printf("  Freeze: %.1fms\n", freeze_time * 1e3);
+    printf("  Bytes per string: %.1f (%.1f without front coding, "
+           "%.1f of strings)\n", (double)front_coded_bytes / count,
+           (double)plain_bytes / count, (double)string_bytes / count);
+    printf("  Lookup: %.1fM strings/sec\n", count / lookup_time / 1e6);
+    printf("  Lookup ID: %.1fM IDs/sec\n", count / lookup_id_time / 1e6);
+}
+
+static void benchmark_tail_merged(uint32_t count) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    char buffer[64];
+    // Domains and their subdomains, so that half of the strings are
+    // suffixes of other strings
+    memcpy(buffer, "www.site", 8);
+    for (uint32_t i = 1; i <= count / 2; i++) {
+        size_t digits = unsigned_string(buffer + 8, i * 2654435761u);
+        memcpy(buffer + 8 + digits, ".com", 5);
+        assert(strings_intern(strings, buffer));
+        assert(strings_intern(strings, buffer + 4));
+    }
+    count = strings_count(strings);
+    struct strings_frozen *frozen = strings_freeze(strings);
+    assert(frozen);
+    double start = now();
+    struct strings_frozen *merged = strings_freeze_tail_merged(strings);
+    assert(merged);
+    double freeze_time = now() - start;
+    strings_free(strings);
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        assert(strings_frozen_lookup_id(merged, id));
+    }
+    double lookup_id_time = now() - start;
+
+    printf("Froze %uM domains with tail merging\n", count / 1000000);
+    printf("  Freeze: %.1fms\n", freeze_time * 1e3);
+    printf("  Bytes per string: %.1f (%.1f without tail merging)\n",
+           (double)strings_frozen_allocated_bytes(merged) / count,
+           (double)strings_frozen_allocated_bytes(frozen) / count);
+    printf("  Merged: %.1fMB\n", strings_frozen_merged_bytes(merged) / 1e6);
+    printf("  Lookup ID: %.1fM IDs/sec\n", count / lookup_id_time / 1e6);
+    strings_frozen_free(merged);
+    strings_frozen_free(frozen);
+}
+
+static void benchmark_compressed(uint32_t count, size_t cache_pages) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    char buffer[32];
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_intern(strings, buffer) == id);
+    }
+    size_t uncompressed_bytes = strings_allocated_bytes(strings);
+    double start = now();
+    assert(strings_compress(strings, cache_pages));
+    double compress_time = now() - start;
+    size_t compressed_bytes = strings_allocated_bytes(strings);
+    size_t pages = strings_compressed_pages(strings);
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_lookup(strings, buffer) == id);
+    }
+    double lookup_time = now() - start;
+    start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        assert(strings_lookup_id(strings, id));
+    }
+    double sequential_time = now() - start;
+    start = now();
+    for (uint32_t i = 1; i <= count; i++) {
+        uint32_t id = (uint32_t)((uint64_t)i * 2654435761u % count) + 1;
+        assert(strings_lookup_id(strings, id));
+    }
+    double random_time = now() - start;
+    strings_free(strings);
+
+    printf("Compressed %uM unique scattered strings (%zu pages cached)\n",
+           count / 1000000, cache_pages);
+    printf("  Compress: %.1fms (%.1fM pages/sec)\n", compress_time * 1e3,
+           pages / compress_time / 1e6);
+    printf("  Total bytes: %.1fMB (%.1fMB before compressing)\n",
+           compressed_bytes / 1e6, uncompressed_bytes / 1e6);
+    printf("  String bytes: %.1fMB (%.1fMB before compressing)\n",
+           (compressed_bytes - (uncompressed_bytes -
+                                pages * strings_page_size())) / 1e6,
+           pages * strings_page_size() / 1e6);
+    printf("  Lookup: %.1fM strings/sec\n", count / lookup_time / 1e6);
+    printf("  Lookup ID (in order): %.1fM IDs/sec\n",
+           count / sequential_time / 1e6);
+    printf("  Lookup ID (random): %.1fM IDs/sec\n",
+           count / random_time / 1e6);
+}
+
+static void benchmark_restore(uint32_t count, uint32_t rollback,
+                              uint32_t rounds) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    char buffer[32];
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_intern(strings, buffer) == id);
+    }
+    struct strings_snapshot snapshot;
+    strings_snapshot(strings, &snapshot);
+    double restore_time = 0;
+    for (uint32_t round = 0; round < rounds; round++) {
+        for (uint32_t i = 1; i <= rollback; i++) {
+            make_key(buffer, count + round * rollback + i, true);
+            assert(strings_intern(strings, buffer) == count + i);
+        }
+        double start = now();
+        assert(strings_restore(strings, &snapshot));
+        restore_time += now() - start;
+    }
+    strings_free(strings);
+
+    printf("Restored %uM unique scattered strings %u times\n",
+           count / 1000000, rounds);
+    printf("  Roll back %u strings: %.1fus\n", rollback,
+           restore_time / rounds * 1e6);
+}
+
+// Generate a 64-bit integer key, e.g. a timestamp or a foreign key
+static void make_integer(char *buffer, uint32_t i) {
+    unsigned64_string(buffer, (i * 11400714819323198485ull) >> 2);
+}
+
+static void benchmark_id64(uint32_t count) {
+    char buffer[32];
+    struct strings *strings = strings_new();
+    assert(strings);
+    double start = now();
+    for (uint32_t id = 1; id <= count; id++) {
+        make_integer(buffer, id);
+        assert(strings_intern(strings, buffer) == id);
+    }
+    double intern32_time = now() - start;
+    size_t bytes32 = strings_allocated_bytes(strings);
+    strings_free(strings);
+
+    strings = strings_new();
+    assert(strings);
+    start = now();
+    for (uint32_t i = 1; i <= count; i++) {
+        make_integer(buffer, i);
+        assert(strings_intern64(strings, buffer));
+    }
+    double intern64_time = now() - start;
+    start = now();
+    for (uint32_t i = 1; i <= count; i++) {
+        make_integer(buffer, i);
+        uint64_t id = strings_lookup64(strings, buffer);
+        assert(!strcmp(strings_lookup_id64(strings, id), buffer));
+    }
+    double round_trip_time = now() - start;
+    size_t bytes64 = strings_allocated_bytes(strings);
+    assert(!strings_count(strings));
+    strings_free(strings);
+
+    printf("Interned %uM unique 64-bit integer strings\n", count / 1000000);
+    printf("  Intern (32-bit IDs): %.1fM strings/sec, %.1fMB\n",
+           count / intern32_time / 1e6, bytes32 / 1e6);
+    printf("  Intern (64-bit IDs): %.1fM strings/sec, %.1fMB\n",
+           count / intern64_time / 1e6, bytes64 / 1e6);
+    printf("  Lookup and decode (64-bit IDs): %.1fM strings/sec\n",
+           count / round_trip_time / 1e6);
+}
+
+static void benchmark_optimize(uint32_t count) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    char buffer[32];
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_intern(strings, buffer) == id);
+    }
+    // Strings are seen with a skewed distribution, so low IDs are hot
+    struct strings_frequency *frequency = strings_frequency_new();
+    assert(frequency);
+    assert(strings_frequency_add_all(frequency, strings));
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t r = (i * 2654435761u) % count;
+        assert(strings_frequency_add(frequency, r * r / count + 1));
+    }
+    uint32_t *remap = malloc(sizeof(*remap) * (count + 1));
+    assert(remap);
+    double start = now();
+    struct strings *optimized = strings_optimize_remap(strings, frequency,
+                                                       remap);
+    assert(optimized);
+    double optimize_time = now() - start;
+    assert(strings_count(optimized) == count);
+    assert(remap[1] == 1);
+    free(remap);
+    strings_frequency_free(frequency);
+    strings_free(optimized);
+    strings_free(strings);
+
+    printf("Optimized %uM unique scattered strings\n", count / 1000000);
+    printf("  Optimize: %.1fms (%.1fM strings/sec)\n", optimize_time * 1e3,
+           count / optimize_time / 1e6);
+}
+
+static void benchmark_sort(uint32_t count) {
+    struct strings *strings = strings_new();
+    assert(strings);
+    char buffer[32];
+    for (uint32_t id = 1; id <= count; id++) {
+        make_key(buffer, id, true);
+        assert(strings_intern(strings, buffer) == id);
+    }
+    uint32_t *remap = malloc(sizeof(*remap) * (count + 1));
+    assert(remap);
+    double start = now();
+    struct strings *sorted = strings_sort(strings, remap);
+    assert(sorted);
+    double sort_time = now() - start;
+    start = now();
+    uint32_t lo, hi;
+    size_t matches = 0;
+    for (uint32_t i = 0; i < 1000000; i++) {
+        make_key(buffer, i + 1, true);
+        assert(strings_prefix_range(sorted, buffer, 14, &lo, &hi));
+        matches += hi - lo;
+    }
+    double range_time = now() - start;
+    assert(matches);
+    free(remap);
+    strings_free(sorted);
+    strings_free(strings);
+
+    printf("Sorted %uM unique scattered strings\n", count / 1000000);
+    printf("  Sort: %.1fms\n", sort_time * 1e3);
+    printf("  Prefix range: %.1fM ranges/sec\n", 1000000 / range_time / 1e6);
+}
 
-    // strings_free(strings);
+int main() {
+    benchmark("sequential", 5000000, false);
+    benchmark("scattered", 5000000, true);
+    benchmark_cache(1000000, 10000000, 16384);
+    benchmark_save_load(5000000);
+    benchmark_shared(5000000);
+    benchmark_file(5000000);
+    benchmark_frozen(5000000);
+    benchmark_front_coded(5000000);
+    benchmark_tail_merged(5000000);
+    benchmark_compressed(5000000, 64);
+    benchmark_id64(5000000);
+    benchmark_restore(5000000, 100, 1000);
+    benchmark_restore(5000000, 10000, 100);
+    benchmark_sort(5000000);
+    benchmark_optimize(5000000);
+    printf("Interned 5M unique scattered strings with 64 shards\n");
+    for (unsigned threads = 1; threads <= 16; threads *= 2) {
+        benchmark_sharded(5000000, threads);
+    }
+    printf("Interned 5M unique scattered strings through a queue\n");
+    for (unsigned threads = 1; threads <= 16; threads *= 2) {
+        benchmark_queue(5000000, threads);
+    }
+    benchmark_queue_latency(100000);
     return 0;
 }
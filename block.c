@@ -1,10 +1,41 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "config.h"
 #include "block.h"
 #include "page.h"
+#include "lz.h"
+
+// Compressed pages are decompressed into a cache, and the pages array
+// points each cached page at its copy in the cache. Reading a cached page
+// therefore costs only a lookup of its cache slot and an update of the
+// time it was last used. The cache replaces the least recently used page.
+// A page which fills up becomes the most recently used page in the cache
+// once it's compressed, keeping its memory, so it's only freed when it's
+// evicted like any other cached page
+struct block_compression {
+    // The compressed data of each page, or NULL for pages which aren't
+    // compressed, e.g. because they didn't compress well
+    void **data;
+    uint32_t *sizes;
+    // The cache slot of each page, or SIZE_MAX if it isn't cached
+    size_t *slots;
+    size_t capacity;
+    size_t compressed_pages;
+    size_t compressed_bytes;
+    // The memory of each cache slot
+    void **cache;
+    // The page in each cache slot, or SIZE_MAX
+    size_t *cached;
+    // The time each cache slot was last used, which is zero for empty slots
+    uint64_t *used;
+    uint64_t clock;
+    size_t cache_pages;
+    void *buffer;
+};
 
 struct block *block_new(size_t page_size) {
     if (!page_size) {
@@ -16,7 +47,7 @@ struct block *block_new(size_t page_size) {
     }
     block->page_size = page_size;
 
-    block->pages = malloc(sizeof(*block->pages));
+    block->pages = malloc(sizeof(*block->pages) * 2);
     block->offsets = malloc(sizeof(*block->offsets));
     if (!block->pages || !block->offsets) {
         goto error;
@@ -27,9 +58,15 @@ struct block *block_new(size_t page_size) {
         goto error;
     }
 
+    block->pages[1] = NULL;
     block->offsets[0] = 0;
     block->size = 1;
     block->count = 1;
+    block->mapped = 0;
+    block->fd = -1;
+    block->extents = NULL;
+    block->extent_count = 0;
+    block->compression = NULL;
 
     return block;
 
@@ -44,38 +81,313 @@ error:
     return NULL;
 }
 
+struct block *block_new_mapped(size_t page_size, void *pages, size_t count,
+                               size_t offset) {
+    if (!page_size || !count || offset > page_size) {
+        return NULL;
+    }
+    struct block *block = malloc(sizeof(*block));
+    if (!block) {
+        return NULL;
+    }
+    block->page_size = page_size;
+    block->size = 1;
+    while (block->size < count) {
+        block->size *= 2;
+    }
+    block->pages = malloc(sizeof(*block->pages) * (block->size + 1));
+    block->offsets = malloc(sizeof(*block->offsets) * block->size);
+    if (!block->pages || !block->offsets) {
+        free(block->pages);
+        free(block->offsets);
+        free(block);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        block->pages[i] = (void *)((uintptr_t)pages + i * page_size);
+        block->offsets[i] = page_size;
+    }
+    block->pages[block->size] = NULL;
+    block->offsets[count - 1] = offset;
+    block->count = count;
+    block->mapped = count;
+    block->fd = -1;
+    block->extents = NULL;
+    block->extent_count = 0;
+    block->compression = NULL;
+    return block;
+}
+
+// The size of each mapping of a file-backed block
+static const size_t extent_bytes = 64 << 20;
+
+// Get a page of a file-backed block, mapping a new extent if necessary.
+// Pages are allocated in order, so only the next extent is ever needed
+static void *file_page(struct block *block, size_t index) {
+    size_t extent = index / block->extent_pages;
+    size_t bytes = block->extent_pages * block->page_size;
+    if (extent == block->extent_count) {
+        void **extents = realloc(block->extents,
+                                 sizeof(*extents) * (extent + 1));
+        if (!extents) {
+            return NULL;
+        }
+        block->extents = extents;
+        if (ftruncate(block->fd, (off_t)(bytes * (extent + 1)))) {
+            return NULL;
+        }
+        void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         block->fd, (off_t)(bytes * extent));
+        if (ptr == MAP_FAILED) {
+            return NULL;
+        }
+        // Pages are read back in ID order only rarely, so readahead would
+        // mostly evict pages that are still wanted
+        madvise(ptr, bytes, MADV_RANDOM);
+#ifdef MADV_COLD
+        // The previous extent is full and is never written to again, so
+        // its pages are the first to go under memory pressure
+        if (extent) {
+            madvise(block->extents[extent - 1], bytes, MADV_COLD);
+        }
+#endif
+        block->extents[block->extent_count++] = ptr;
+    }
+    return (void *)((uintptr_t)block->extents[extent] +
+                    (index % block->extent_pages) * block->page_size);
+}
+
+struct block *block_new_file(size_t page_size, int fd) {
+    long system_page_size = sysconf(_SC_PAGESIZE);
+    if (!page_size || page_size > extent_bytes || system_page_size <= 0) {
+        return NULL;
+    }
+    size_t extent_pages = extent_bytes / page_size;
+    if ((extent_pages * page_size) % (size_t)system_page_size) {
+        return NULL;
+    }
+    struct block *block = malloc(sizeof(*block));
+    if (!block) {
+        return NULL;
+    }
+    block->page_size = page_size;
+    block->pages = malloc(sizeof(*block->pages) * 2);
+    block->offsets = malloc(sizeof(*block->offsets));
+    block->fd = dup(fd);
+    block->extents = NULL;
+    block->extent_pages = extent_pages;
+    block->extent_count = 0;
+    if (!block->pages || !block->offsets || block->fd < 0 ||
+            ftruncate(block->fd, 0)) {
+        goto error;
+    }
+    block->pages[0] = file_page(block, 0);
+    if (!block->pages[0]) {
+        goto error;
+    }
+    block->pages[1] = NULL;
+    block->offsets[0] = 0;
+    block->size = 1;
+    block->count = 1;
+    block->mapped = 0;
+    block->compression = NULL;
+    return block;
+
+error:
+    free(block->pages);
+    free(block->offsets);
+    free(block->extents);
+    if (block->fd >= 0) {
+        close(block->fd);
+    }
+    free(block);
+    return NULL;
+}
+
+static bool is_compressed(const struct block *block, size_t index) {
+    return block->compression && index < block->compression->capacity &&
+        block->compression->data[index];
+}
+
+// Drop a page from the cache, if it's cached
+static void uncache(struct block *block, size_t index) {
+    struct block_compression *compression = block->compression;
+    size_t slot = compression->slots[index];
+    if (slot != SIZE_MAX) {
+        compression->cached[slot] = SIZE_MAX;
+        compression->used[slot] = 0;
+        compression->slots[index] = SIZE_MAX;
+    }
+    block->pages[index] = NULL;
+}
+
+static void free_compressed(struct block *block, size_t index) {
+    struct block_compression *compression = block->compression;
+    uncache(block, index);
+    free(compression->data[index]);
+    compression->data[index] = NULL;
+    compression->compressed_pages--;
+    compression->compressed_bytes -= compression->sizes[index];
+}
+
+static void free_compression(struct block_compression *compression,
+                             size_t page_size) {
+    for (size_t i = 0; i < compression->capacity; i++) {
+        free(compression->data[i]);
+    }
+    if (compression->cache) {
+        for (size_t slot = 0; slot < compression->cache_pages; slot++) {
+            if (compression->cache[slot]) {
+                page_free(compression->cache[slot], page_size);
+            }
+        }
+    }
+    free(compression->data);
+    free(compression->sizes);
+    free(compression->slots);
+    free(compression->cache);
+    free(compression->cached);
+    free(compression->used);
+    free(compression->buffer);
+    free(compression);
+}
+
 void block_free(struct block *block) {
-    for (size_t i = 0; i < block->count; i++) {
-        page_free(block->pages[i], block->page_size);
+    if (block->fd >= 0) {
+        size_t bytes = block->extent_pages * block->page_size;
+        for (size_t i = 0; i < block->extent_count; i++) {
+            munmap(block->extents[i], bytes);
+        }
+        free(block->extents);
+        close(block->fd);
+    } else {
+        for (size_t i = block->mapped; i < block->count; i++) {
+            if (!is_compressed(block, i)) {
+                page_free(block->pages[i], block->page_size);
+            }
+        }
+    }
+    if (block->compression) {
+        free_compression(block->compression, block->page_size);
     }
     free(block->offsets);
-    free(block->pages);
+    void **pages = block->pages;
+    for (size_t size = block->size; pages; size /= 2) {
+        void **previous = pages[size];
+        free(pages);
+        pages = previous;
+    }
     free(block);
 }
 
+// Take the least recently used slot of the cache, evicting the page in it
+static size_t cache_slot(const struct block *block) {
+    struct block_compression *compression = block->compression;
+    size_t slot = 0;
+    for (size_t i = 1; i < compression->cache_pages; i++) {
+        if (compression->used[i] < compression->used[slot]) {
+            slot = i;
+        }
+    }
+    size_t evicted = compression->cached[slot];
+    if (evicted != SIZE_MAX) {
+        block->pages[evicted] = NULL;
+        compression->slots[evicted] = SIZE_MAX;
+    }
+    compression->used[slot] = ++compression->clock;
+    return slot;
+}
+
+// Compress a full page. Pages are left as they are if they can't be
+// compressed by at least an eighth, or if memory can't be allocated
+static void compress_page(struct block *block, size_t index) {
+    struct block_compression *compression = block->compression;
+    if (index < block->mapped) {
+        return;
+    }
+    if (index >= compression->capacity) {
+        size_t capacity = block->size;
+        void **data = realloc(compression->data, sizeof(*data) * capacity);
+        if (!data) {
+            return;
+        }
+        compression->data = data;
+        uint32_t *sizes = realloc(compression->sizes,
+                                  sizeof(*sizes) * capacity);
+        if (!sizes) {
+            return;
+        }
+        compression->sizes = sizes;
+        size_t *slots = realloc(compression->slots,
+                                sizeof(*slots) * capacity);
+        if (!slots) {
+            return;
+        }
+        compression->slots = slots;
+        for (size_t i = compression->capacity; i < capacity; i++) {
+            data[i] = NULL;
+            slots[i] = SIZE_MAX;
+        }
+        compression->capacity = capacity;
+    }
+    size_t used = block->offsets[index];
+    size_t size = lz_compress(block->pages[index], used, compression->buffer,
+                              used - used / 8);
+    if (!size) {
+        return;
+    }
+    void *data = malloc(size);
+    if (!data) {
+        return;
+    }
+    memcpy(data, compression->buffer, size);
+    compression->data[index] = data;
+    compression->sizes[index] = size;
+    compression->compressed_pages++;
+    compression->compressed_bytes += size;
+    // The page takes the place of the least recently used page's memory in
+    // the cache, so that pointers into it stay valid until it's evicted
+    size_t slot = cache_slot(block);
+    page_free(compression->cache[slot], block->page_size);
+    compression->cache[slot] = block->pages[index];
+    compression->cached[slot] = index;
+    compression->slots[index] = slot;
+}
+
 __attribute__ ((noinline))
 static void *add_page(struct block *block) {
     if (block->count == block->size) {
         size_t new_size = block->size * 2;
-        void **pages = realloc(block->pages, sizeof(*pages) * new_size);
+        // Readers may be indexing the pages array concurrently, so it's
+        // copied rather than reallocated, and the new array is published
+        // once it's complete. Old arrays are chained from the extra element
+        // at the end of each array and are kept until the block is freed
+        void **pages = malloc(sizeof(*pages) * (new_size + 1));
         if (!pages) {
             return NULL;
         }
-        block->pages = pages;
         size_t *offsets = realloc(block->offsets, sizeof(*offsets) * new_size);
         if (!offsets) {
+            free(pages);
             return NULL;
         }
         block->offsets = offsets;
+        memcpy(pages, block->pages, sizeof(*pages) * block->count);
+        pages[new_size] = block->pages;
+        __atomic_store_n(&block->pages, pages, __ATOMIC_RELEASE);
         block->size = new_size;
     }
-    void *page = page_alloc(block->page_size);
+    void *page = block->fd >= 0 ? file_page(block, block->count) :
+        page_alloc(block->page_size);
     if (!page) {
         return NULL;
     }
     block->pages[block->count] = page;
     block->offsets[block->count] = 0;
     block->count++;
+    if (block->compression) {
+        compress_page(block, block->count - 2);
+    }
     return page;
 }
 
@@ -113,17 +425,127 @@ bool block_restore(struct block *block,
             block->offsets[block->count - 1] < snapshot->offset) {
         return false;
     }
+    // The page that becomes the last page is written to again, so it's
+    // decompressed for good
+    size_t last = snapshot->count - 1;
+    if (is_compressed(block, last)) {
+        void *page = page_alloc(block->page_size);
+        if (!page) {
+            return false;
+        }
+        memcpy(page, block_page(block, last), block->offsets[last]);
+        free_compressed(block, last);
+        block->pages[last] = page;
+    }
+    // Pages of a file-backed block stay mapped, and are reused when the
+    // block grows again
     for (size_t i = snapshot->count; i < block->count; i++) {
-        page_free(block->pages[i], block->page_size);
+        if (is_compressed(block, i)) {
+            free_compressed(block, i);
+        } else if (i >= block->mapped && block->fd < 0) {
+            page_free(block->pages[i], block->page_size);
+        }
     }
     block->count = snapshot->count;
+    if (block->mapped > block->count) {
+        block->mapped = block->count;
+    }
     block->offsets[snapshot->count - 1] = snapshot->offset;
     return true;
 }
 
 size_t block_allocated_bytes(const struct block *block) {
-    return block->count * block->page_size +
+    size_t pages_bytes = 0;
+    for (size_t size = block->size; size; size /= 2) {
+        pages_bytes += (size + 1) * sizeof(*block->pages);
+    }
+    size_t compression_bytes = 0;
+    size_t pages = block->count;
+    const struct block_compression *compression = block->compression;
+    if (compression) {
+        pages -= compression->compressed_pages;
+        compression_bytes = compression->compressed_bytes +
+            (compression->cache_pages + 1) * block->page_size +
+            compression->cache_pages * (sizeof(*compression->cache) +
+                                        sizeof(*compression->cached) +
+                                        sizeof(*compression->used)) +
+            compression->capacity * (sizeof(*compression->data) +
+                                     sizeof(*compression->sizes) +
+                                     sizeof(*compression->slots)) +
+            sizeof(*compression);
+    }
+    return pages * block->page_size +
         block->size * sizeof(*block->offsets) +
-        block->size * sizeof(*block->pages) +
+        pages_bytes + compression_bytes +
         sizeof(*block);
 }
+
+bool block_compress(struct block *block, size_t cache_pages) {
+    if (block->fd >= 0 || block->compression || !cache_pages) {
+        return false;
+    }
+    struct block_compression *compression = calloc(1, sizeof(*compression));
+    if (!compression) {
+        return false;
+    }
+    compression->capacity = block->size;
+    compression->data = calloc(compression->capacity,
+                               sizeof(*compression->data));
+    compression->sizes = calloc(compression->capacity,
+                                sizeof(*compression->sizes));
+    compression->slots = malloc(sizeof(*compression->slots) *
+                                compression->capacity);
+    compression->cache = calloc(cache_pages, sizeof(*compression->cache));
+    compression->cached = malloc(sizeof(*compression->cached) * cache_pages);
+    compression->used = calloc(cache_pages, sizeof(*compression->used));
+    compression->buffer = malloc(block->page_size);
+    compression->cache_pages = cache_pages;
+    if (!compression->data || !compression->sizes || !compression->slots ||
+            !compression->cache || !compression->cached ||
+            !compression->used || !compression->buffer) {
+        free_compression(compression, block->page_size);
+        return false;
+    }
+    for (size_t i = 0; i < compression->capacity; i++) {
+        compression->slots[i] = SIZE_MAX;
+    }
+    for (size_t slot = 0; slot < cache_pages; slot++) {
+        compression->cached[slot] = SIZE_MAX;
+        compression->cache[slot] = page_alloc(block->page_size);
+        if (!compression->cache[slot]) {
+            free_compression(compression, block->page_size);
+            return false;
+        }
+    }
+    block->compression = compression;
+    for (size_t i = block->mapped; i + 1 < block->count; i++) {
+        compress_page(block, i);
+    }
+    return true;
+}
+
+void *block_load_page(const struct block *block, size_t index) {
+    struct block_compression *compression = block->compression;
+    size_t slot = cache_slot(block);
+    void *page = compression->cache[slot];
+    // Pages are only ever decompressed from data compressed in memory, so
+    // this can't fail
+    lz_decompress(compression->data[index], compression->sizes[index], page,
+                  block->offsets[index]);
+    compression->cached[slot] = index;
+    compression->slots[index] = slot;
+    block->pages[index] = page;
+    return page;
+}
+
+void block_touch_page(const struct block *block, size_t index) {
+    struct block_compression *compression = block->compression;
+    if (index < compression->capacity &&
+            compression->slots[index] != SIZE_MAX) {
+        compression->used[compression->slots[index]] = ++compression->clock;
+    }
+}
+
+size_t block_compressed_pages(const struct block *block) {
+    return block->compression ? block->compression->compressed_pages : 0;
+}
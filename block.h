@@ -4,17 +4,44 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+// Blocks are append-only: memory that has been allocated is never moved, so
+// pointers into a block (and the pages array) remain valid for readers in
+// other threads while a single writer allocates
 struct block {
     size_t page_size;
     void **pages;
     size_t *offsets;
     size_t count;
     size_t size;
+    size_t mapped;
+    // File-backed blocks map pages from a file in extents, and page i is
+    // always at offset i * page_size in the file. fd is -1 otherwise
+    int fd;
+    void **extents;
+    size_t extent_pages;
+    size_t extent_count;
+    // Compressed blocks (see block_compress()) have NULL entries in the
+    // pages array for pages which are compressed and aren't cached
+    struct block_compression *compression;
 };
 
 // Create a new block allocator
 struct block *block_new(size_t page_size);
 
+// Create a block allocator whose first count pages are in an existing,
+// contiguous region of memory, e.g. a mapped file. The last of these pages
+// has offset bytes allocated. The region is not freed with the block
+struct block *block_new_mapped(size_t page_size, void *pages, size_t count,
+                               size_t offset);
+
+// Create a block allocator whose pages are in a file rather than in
+// anonymous memory. The file is extended (sparsely) and mapped in large
+// extents as pages are allocated, so the kernel can write back and evict
+// pages that aren't being used. Any existing contents of the file are
+// overwritten. The file descriptor is duplicated, so the caller can close
+// it. This function returns NULL if an error occurred
+struct block *block_new_file(size_t page_size, int fd);
+
 // Free a block allocator
 void block_free(struct block*);
 
@@ -30,11 +57,45 @@ struct block_snapshot {
 void block_snapshot(const struct block*, struct block_snapshot*);
 
 // Restore the allocator to a previous position. Any allocations made after
-// the snapshot are removed. This function returns true if the restore was
-// successful, and false if an error occurred
+// the snapshot are removed, and must not be accessed by other threads. This
+// function returns true if the restore was successful, and false if an
+// error occurred
 bool block_restore(struct block*, const struct block_snapshot*);
 
 // Get the total bytes allocated, including overhead
 size_t block_allocated_bytes(const struct block*);
 
+// Compress pages of the block, other than pages of a mapped region, as
+// they fill up (and any which are already full). Compressed pages are
+// decompressed into a cache of cache_pages pages when they're read, and
+// replace the least recently used page in the cache. A page which fills up
+// stays in memory as the most recently used page in the cache, as does a
+// page obtained from block_page(), so a pointer into it stays valid while
+// up to cache_pages - 1 other pages are decompressed or fill up. Compressed
+// blocks must only be used by one thread. This function returns false if
+// the block is file-backed, is already compressed, or an error occurred
+bool block_compress(struct block*, size_t cache_pages);
+
+// Decompress a page into the cache. The page must be compressed and not
+// cached, i.e. its entry in the pages array must be NULL
+void *block_load_page(const struct block*, size_t index);
+
+// Mark a page as used, if it's in the cache of a compressed block
+void block_touch_page(const struct block*, size_t index);
+
+// Get a page, decompressing it if necessary
+static inline void *block_page(const struct block *block, size_t index) {
+    void *page = __atomic_load_n(&block->pages, __ATOMIC_ACQUIRE)[index];
+    if (!page) {
+        return block_load_page(block, index);
+    }
+    if (block->compression) {
+        block_touch_page(block, index);
+    }
+    return page;
+}
+
+// Get the number of pages which are compressed
+size_t block_compressed_pages(const struct block*);
+
 #endif
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cache.h"
+
+#define CACHE_LINE 64
+
+// Entries hold a copy of the string so that hits never touch the
+// repository, and are the size of a cache line. The entries are aligned to
+// a cache line, so that each probe touches only one
+struct cache_entry {
+    uint32_t id;
+    uint16_t len;
+    uint16_t referenced;
+    char string[STRINGS_CACHE_MAX_LENGTH];
+};
+
+struct strings_cache {
+    struct strings *strings;
+    struct cache_entry *entries;
+    size_t mask;
+    uint32_t generation;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct strings_cache *strings_cache_new(struct strings *strings,
+                                        size_t size) {
+    struct strings_cache *cache = malloc(sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    size_t entries = 1;
+    while (entries < size) {
+        entries *= 2;
+    }
+    if (posix_memalign((void **)&cache->entries, CACHE_LINE,
+                       entries * sizeof(*cache->entries))) {
+        free(cache);
+        return NULL;
+    }
+    memset(cache->entries, 0, entries * sizeof(*cache->entries));
+    cache->strings = strings;
+    cache->mask = entries - 1;
+    cache->generation = strings_generation(strings);
+    cache->hits = 0;
+    cache->misses = 0;
+    return cache;
+}
+
+void strings_cache_free(struct strings_cache *cache) {
+    free(cache->entries);
+    free(cache);
+}
+
+static inline uint64_t cache_read(const char *string, size_t len) {
+    uint64_t value = 0;
+    memcpy(&value, string, len < sizeof(value) ? len : sizeof(value));
+    return value;
+}
+
+// Pick an entry with a cheap hash of the length and the first and last 8
+// bytes of the string. Collisions only cost a miss, since hits compare the
+// whole string
+static inline struct cache_entry *cache_slot(struct strings_cache *cache,
+                                             const char *string, size_t len) {
+    uint64_t hash = cache_read(string, len) ^ len;
+    if (len > sizeof(hash)) {
+        hash ^= cache_read(string + len - sizeof(hash), sizeof(hash)) *
+            0x9E3779B97F4A7C15ULL;
+    }
+    hash *= 0xFF51AFD7ED558CCDULL;
+    return &cache->entries[(hash >> 32) & cache->mask];
+}
+
+// Drop every entry if strings have been removed from the repository
+static inline void cache_check(struct strings_cache *cache) {
+    uint32_t generation = strings_generation(cache->strings);
+    if (generation != cache->generation) {
+        memset(cache->entries, 0,
+               (cache->mask + 1) * sizeof(*cache->entries));
+        cache->generation = generation;
+    }
+}
+
+uint32_t strings_cache_get(struct strings_cache *cache, const char *string,
+                           size_t len) {
+    if (len > STRINGS_CACHE_MAX_LENGTH) {
+        cache->misses++;
+        return 0;
+    }
+    cache_check(cache);
+    struct cache_entry *entry = cache_slot(cache, string, len);
+    if (entry->id && entry->len == len &&
+            !memcmp(entry->string, string, len)) {
+        entry->referenced = 1;
+        cache->hits++;
+        return entry->id;
+    }
+    cache->misses++;
+    return 0;
+}
+
+void strings_cache_put(struct strings_cache *cache, const char *string,
+                       size_t len, uint32_t id) {
+    if (!id || len > STRINGS_CACHE_MAX_LENGTH) {
+        return;
+    }
+    struct cache_entry *entry = cache_slot(cache, string, len);
+    // An entry which has been hit since it was added gets a second chance,
+    // so that a stream of rare strings doesn't evict the hot ones
+    if (entry->referenced) {
+        entry->referenced = 0;
+        return;
+    }
+    entry->id = id;
+    entry->len = len;
+    memcpy(entry->string, string, len);
+}
+
+uint32_t strings_cache_intern(struct strings_cache *cache, const char *string,
+                              size_t len) {
+    uint32_t id = strings_cache_get(cache, string, len);
+    if (!id) {
+        id = strings_intern_len(cache->strings, string, len);
+        strings_cache_put(cache, string, len, id);
+    }
+    return id;
+}
+
+uint32_t strings_cache_lookup(struct strings_cache *cache, const char *string,
+                              size_t len) {
+    uint32_t id = strings_cache_get(cache, string, len);
+    if (!id) {
+        id = strings_lookup_len(cache->strings, string, len);
+        strings_cache_put(cache, string, len, id);
+    }
+    return id;
+}
+
+uint64_t strings_cache_hits(const struct strings_cache *cache) {
+    return cache->hits;
+}
+
+uint64_t strings_cache_misses(const struct strings_cache *cache) {
+    return cache->misses;
+}
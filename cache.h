@@ -0,0 +1,48 @@
+#ifndef INTERN_CACHE_H_
+#define INTERN_CACHE_H_
+
+#include "strings.h"
+
+// A small, direct-mapped cache of recent string => ID mappings, which sits
+// in front of a repository. When a few strings account for most calls, the
+// cache answers those calls without hashing the whole string or touching
+// the repository's index. A cache belongs to a single thread (or handle),
+// so it needs no synchronization of its own
+struct strings_cache;
+
+// Strings longer than this are never cached
+#define STRINGS_CACHE_MAX_LENGTH 56
+
+// Create a cache with the specified number of entries, which is rounded up
+// to a power of two. Each entry uses 64 bytes. This function returns NULL
+// if an error occurred
+struct strings_cache *strings_cache_new(struct strings*, size_t size);
+
+// Free a cache
+void strings_cache_free(struct strings_cache*);
+
+// Intern a string, checking the cache first
+uint32_t strings_cache_intern(struct strings_cache*, const char *string,
+                              size_t len);
+
+// Lookup the ID for a string, checking the cache first. This function
+// returns zero if the string does not exist in the repository
+uint32_t strings_cache_lookup(struct strings_cache*, const char *string,
+                              size_t len);
+
+// Check only the cache, returning zero on a miss. Along with
+// strings_cache_put(), this allows the repository to only be accessed
+// (e.g. with a lock held) when the cache misses
+uint32_t strings_cache_get(struct strings_cache*, const char *string,
+                           size_t len);
+
+// Add a string => ID mapping to the cache. Rather than replacing an entry
+// which has been hit since it was added, the entry is given a second chance
+void strings_cache_put(struct strings_cache*, const char *string, size_t len,
+                       uint32_t id);
+
+// Get the number of cache hits and misses
+uint64_t strings_cache_hits(const struct strings_cache*);
+uint64_t strings_cache_misses(const struct strings_cache*);
+
+#endif
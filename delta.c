@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "delta.h"
+#include "hash.h"
+
+// A delta is a header, followed by each string as a variable-length
+// (LEB128) length and its bytes, and then a fingerprint of the strings.
+// Integers are little-endian so that deltas can be shipped between hosts.
+// The header records the number of strings the primary had at the time of
+// the snapshot, and a fingerprint of the last of them, so that deltas can
+// only be applied to a replica in the same state
+static const uint8_t delta_magic[4] = {'I', 'S', 'D', 1};
+
+#define DELTA_BUFFER 65536
+
+// Fingerprints use SipHash with a fixed key so that they are the same on
+// every host, regardless of the hash function or key a repository uses
+static const uint64_t fingerprint_key[2] = {0, 0};
+
+static uint64_t fingerprint(uint64_t fingerprint, const char *string,
+                            size_t len) {
+    uint64_t hash = hash_string_keyed(string, len, fingerprint_key);
+    return (fingerprint + hash) * 0x9E3779B97F4A7C15ULL;
+}
+
+// Get the fingerprint of the string with the highest ID below a delta, or
+// zero if the delta starts at the first string
+static uint64_t base_fingerprint(const struct strings *strings,
+                                 uint32_t base) {
+    struct strings_cursor cursor;
+    strings_cursor_init(&cursor, strings);
+    if (!base || !strings_cursor_seek(&cursor, base)) {
+        return 0;
+    }
+    return fingerprint(0, strings_cursor_string(&cursor),
+                       strings_cursor_length(&cursor));
+}
+
+static void encode_u32(uint8_t *buffer, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buffer[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+static void encode_u64(uint8_t *buffer, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        buffer[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+static uint32_t decode_u32(const uint8_t *buffer) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)buffer[i] << (i * 8);
+    }
+    return value;
+}
+
+static uint64_t decode_u64(const uint8_t *buffer) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)buffer[i] << (i * 8);
+    }
+    return value;
+}
+
+struct output {
+    struct strings_delta_writer *writer;
+    size_t length;
+    uint8_t buffer[DELTA_BUFFER];
+};
+
+static bool output_flush(struct output *output) {
+    if (!output->length) {
+        return true;
+    }
+    struct strings_delta_writer *writer = output->writer;
+    bool ok = writer->write(writer->context, output->buffer, output->length);
+    output->length = 0;
+    return ok;
+}
+
+static bool output_write(struct output *output, const void *data,
+                         size_t bytes) {
+    if (DELTA_BUFFER - output->length < bytes) {
+        if (!output_flush(output)) {
+            return false;
+        }
+        if (bytes > DELTA_BUFFER) {
+            struct strings_delta_writer *writer = output->writer;
+            return writer->write(writer->context, data, bytes);
+        }
+    }
+    memcpy(output->buffer + output->length, data, bytes);
+    output->length += bytes;
+    return true;
+}
+
+static bool output_varint(struct output *output, uint64_t value) {
+    uint8_t buffer[10];
+    size_t length = 0;
+    do {
+        buffer[length] = value & 0x7F;
+        value >>= 7;
+        if (value) {
+            buffer[length] |= 0x80;
+        }
+        length++;
+    } while (value);
+    return output_write(output, buffer, length);
+}
+
+bool strings_export_since(const struct strings *strings,
+                          const struct strings_snapshot *snapshot,
+                          struct strings_delta_writer *writer) {
+    uint32_t base = snapshot->total;
+    uint32_t total = strings_count(strings);
+    if (base > total) {
+        return false;
+    }
+    struct output *output = malloc(sizeof(*output));
+    if (!output) {
+        return false;
+    }
+    output->writer = writer;
+    output->length = 0;
+
+    uint8_t header[20];
+    memcpy(header, delta_magic, sizeof(delta_magic));
+    encode_u32(header + 4, base);
+    encode_u32(header + 8, total - base);
+    encode_u64(header + 12, base_fingerprint(strings, base));
+    bool ok = output_write(output, header, sizeof(header));
+
+    uint64_t delta_fingerprint = 0;
+    struct strings_cursor cursor;
+    strings_cursor_init(&cursor, strings);
+    if (ok && base < total) {
+        strings_cursor_seek(&cursor, base + 1);
+        do {
+            const char *string = strings_cursor_string(&cursor);
+            size_t len = strings_cursor_length(&cursor);
+            delta_fingerprint = fingerprint(delta_fingerprint, string, len);
+            ok = output_varint(output, len) &&
+                output_write(output, string, len);
+        } while (ok && strings_cursor_id(&cursor) < total &&
+                 strings_cursor_next(&cursor));
+    }
+
+    uint8_t trailer[8];
+    encode_u64(trailer, delta_fingerprint);
+    ok = ok && output_write(output, trailer, sizeof(trailer)) &&
+        output_flush(output);
+    free(output);
+    return ok;
+}
+
+struct input {
+    struct strings_delta_reader *reader;
+    size_t position;
+    size_t length;
+    uint8_t buffer[DELTA_BUFFER];
+};
+
+static bool input_fill(struct input *input) {
+    struct strings_delta_reader *reader = input->reader;
+    input->position = 0;
+    input->length = reader->read(reader->context, input->buffer,
+                                 DELTA_BUFFER);
+    return input->length > 0;
+}
+
+static bool input_read(struct input *input, void *data, size_t bytes) {
+    uint8_t *ptr = data;
+    while (bytes) {
+        if (input->position == input->length && !input_fill(input)) {
+            return false;
+        }
+        size_t available = input->length - input->position;
+        size_t chunk = bytes < available ? bytes : available;
+        memcpy(ptr, input->buffer + input->position, chunk);
+        input->position += chunk;
+        ptr += chunk;
+        bytes -= chunk;
+    }
+    return true;
+}
+
+static bool input_varint(struct input *input, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        if (!input_read(input, &byte, 1)) {
+            return false;
+        }
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Read a string, returning a pointer into the input buffer if the string
+// is there in full, or else copying it into scratch space
+static const char *input_string(struct input *input, size_t len,
+                                char **scratch, size_t *scratch_size) {
+    if (input->length - input->position >= len) {
+        const char *string = (const char *)input->buffer + input->position;
+        input->position += len;
+        return string;
+    }
+    if (*scratch_size < len) {
+        char *buffer = realloc(*scratch, len);
+        if (!buffer) {
+            return NULL;
+        }
+        *scratch = buffer;
+        *scratch_size = len;
+    }
+    return input_read(input, *scratch, len) ? *scratch : NULL;
+}
+
+bool strings_import_delta(struct strings *strings,
+                          struct strings_delta_reader *reader) {
+    struct input *input = malloc(sizeof(*input));
+    if (!input) {
+        return false;
+    }
+    input->reader = reader;
+    input->position = 0;
+    input->length = 0;
+
+    uint8_t header[20];
+    if (!input_read(input, header, sizeof(header)) ||
+            memcmp(header, delta_magic, sizeof(delta_magic))) {
+        free(input);
+        return false;
+    }
+    uint32_t base = decode_u32(header + 4);
+    uint32_t count = decode_u32(header + 8);
+    // A failed import is undone with strings_restore(), which can't remove
+    // strings that a pinned version can see
+    if (strings_version_pinned(strings) || base != strings_count(strings) ||
+            decode_u64(header + 12) != base_fingerprint(strings, base) ||
+            count > UINT32_MAX - base) {
+        free(input);
+        return false;
+    }
+
+    struct strings_snapshot snapshot;
+    strings_snapshot(strings, &snapshot);
+    char *scratch = NULL;
+    size_t scratch_size = 0;
+    uint64_t delta_fingerprint = 0;
+    bool ok = true;
+    for (uint32_t i = 1; ok && i <= count; i++) {
+        uint64_t len;
+        const char *string = NULL;
+        if (input_varint(input, &len) && len <= SIZE_MAX) {
+            string = input_string(input, len, &scratch, &scratch_size);
+        }
+        ok = string &&
+            strings_intern_len(strings, string, len) == base + i;
+        if (ok) {
+            delta_fingerprint = fingerprint(delta_fingerprint, string, len);
+        }
+    }
+    uint8_t trailer[8];
+    ok = ok && input_read(input, trailer, sizeof(trailer)) &&
+        decode_u64(trailer) == delta_fingerprint;
+    if (!ok && !strings_restore(strings, &snapshot)) {
+        // A version pinned by a reader during the import can see some of
+        // the strings, so they can't be removed. Each of them was given its
+        // ID on the primary, so the replica still matches the primary up to
+        // its count, but the import is only partly undone (see delta.h)
+        free(scratch);
+        free(input);
+        return false;
+    }
+    free(scratch);
+    free(input);
+    return ok;
+}
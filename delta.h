@@ -0,0 +1,39 @@
+#ifndef INTERN_DELTA_H_
+#define INTERN_DELTA_H_
+
+#include "strings.h"
+
+// Deltas are written to and read from callbacks, e.g. wrapping a file or a
+// socket. write returns false if an error occurred. read reads up to the
+// specified number of bytes, and returns the number of bytes read, or 0 at
+// the end of the input or if an error occurred
+struct strings_delta_writer {
+    bool (*write)(void *context, const void *data, size_t bytes);
+    void *context;
+};
+
+struct strings_delta_reader {
+    size_t (*read)(void *context, void *data, size_t bytes);
+    void *context;
+};
+
+// Export the strings added to a repository since a snapshot, in a compact
+// binary format. This takes time proportional to the size of the delta.
+// This function returns true if the delta was written, and false if an
+// error occurred
+bool strings_export_since(const struct strings*,
+                          const struct strings_snapshot*,
+                          struct strings_delta_writer*);
+
+// Apply a delta to a replica of the repository it was exported from. The
+// replica must contain exactly the strings the primary had at the time of
+// the snapshot, and the strings in the delta must be given the same IDs
+// they have on the primary. If either check fails, or the delta is
+// malformed, the replica is left unchanged and this function returns false.
+// Imports are undone with strings_restore(), so an import isn't started
+// while a version of the replica is pinned. If a reader pins a version
+// during a failed import, the strings that the version can see are kept,
+// and strings_count() tells how far the import got
+bool strings_import_delta(struct strings*, struct strings_delta_reader*);
+
+#endif
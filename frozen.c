@@ -0,0 +1,848 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "frozen.h"
+#include "hash.h"
+#include "inline.h"
+
+// The perfect hash function is built by "hash and displace" (as in CHD and
+// PTHash). Strings are hashed into buckets, averaging bucket_size strings
+// each. Buckets are then placed from largest to smallest, and each bucket
+// is given the first pilot value which sends every string in it to a free
+// slot. A lookup hashes the string, loads its bucket's pilot, and mixes the
+// two to find its slot. Buckets are skewed so that 60% of strings fall into
+// 30% of buckets, since large buckets are easier to place while the table
+// is mostly empty. Strings are placed in a table that's 5% larger than
+// needed, which saves most of the tries for the last few buckets, and then
+// strings in the extra 5% of slots are moved into the free slots below
+// count (as in PTHash). Lookups that land in the extra slots go through a
+// small remap array
+static const uint32_t bucket_size = 4;
+static const uint32_t extra_slots_divisor = 20;
+static const uint32_t dense_keys = 0x9999999A;  // 60% of 2^32
+static const uint32_t dense_buckets_percent = 30;
+
+// The number of seeds to try before giving up, e.g. if two strings have
+// the same 64-bit hash
+static const int max_attempts = 8;
+
+// Pilots are tried up to this value before a new seed is tried. The last
+// few buckets (of one string each) need roughly as many tries as there are
+// strings
+static const uint32_t max_pilot = UINT32_MAX;
+
+// Front-coded strings are stored in runs of this many strings, in ID order.
+// Each string is stored as the length of the prefix it shares with the
+// previous string in its run (zero for the first), the length of the rest
+// of the string, and then the rest of the string. Lengths are varints, and
+// only the offset of each run is kept
+static const uint32_t run_size = 16;
+
+enum frozen_layout {
+    layout_plain,
+    layout_front_coded,
+    layout_tail_merged
+};
+
+// Strings with an embedded NULL byte have their lengths stored when
+// strings are tail-merged, since their length can't be found with strlen()
+struct frozen_length {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct frozen_slot {
+    uint32_t fingerprint;
+    uint32_t id;
+};
+
+struct strings_frozen {
+    uint32_t count;
+    uint32_t table_size;
+    uint32_t buckets;
+    uint32_t dense_buckets;
+    uint64_t seed;
+    uint32_t *pilots;
+    uint32_t *remap;
+    struct frozen_slot *slots;
+    // Strings are stored with a trailing NULL byte. Offsets are 32-bit
+    // unless the strings take up more than 4GB, and there is one more
+    // offset than there are strings so that lengths are implied. When
+    // strings are front-coded there is one offset per run instead, and
+    // when strings are tail-merged there is one offset per string and
+    // lengths are found with strlen()
+    char *data;
+    size_t data_size;
+    uint32_t *offsets;
+    uint64_t *wide_offsets;
+    enum frozen_layout layout;
+    struct frozen_length *lengths;
+    uint32_t length_count;
+    size_t merged_bytes;
+    // Front-coded strings are decoded into this buffer, which has room for
+    // the longest string
+    char *decoded;
+    size_t decoded_size;
+#ifdef INLINE_UNSIGNED
+    char buffer[11];
+#endif
+};
+
+// The MurmurHash3 finalizer
+static inline uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Hash a string for the perfect hash function. This is always wyhash, even
+// with DJB2_HASH, since strings which collide under DJB2 collide for every
+// seed, and a new seed must separate any strings that collided
+static inline uint64_t frozen_hash(const char *string, size_t len,
+                                   uint64_t seed) {
+    return wyhash(string, len, seed);
+}
+
+// Map a 32-bit value onto [0, n) without a division
+static inline uint32_t reduce(uint32_t x, uint32_t n) {
+    return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+static inline uint32_t frozen_bucket(const struct strings_frozen *frozen,
+                                     uint64_t hash) {
+    if ((uint32_t)(hash >> 32) < dense_keys) {
+        return reduce((uint32_t)hash, frozen->dense_buckets);
+    }
+    return frozen->dense_buckets +
+        reduce((uint32_t)hash, frozen->buckets - frozen->dense_buckets);
+}
+
+static inline uint32_t frozen_slot(const struct strings_frozen *frozen,
+                                   uint64_t hash, uint32_t pilot) {
+    uint64_t mixed = mix(hash ^ (pilot * 0x9E3779B97F4A7C15ULL));
+    return reduce((uint32_t)(mixed >> 32), frozen->table_size);
+}
+
+static inline uint32_t frozen_fingerprint(uint64_t hash) {
+    return (uint32_t)mix(hash + 0x2545F4914F6CDD1DULL);
+}
+
+static inline size_t frozen_offset(const struct strings_frozen *frozen,
+                                   size_t index) {
+    if (frozen->wide_offsets) {
+        return frozen->wide_offsets[index];
+    }
+    return frozen->offsets[index];
+}
+
+static inline void set_offset(struct strings_frozen *frozen, size_t index,
+                              size_t offset) {
+    if (frozen->wide_offsets) {
+        frozen->wide_offsets[index] = offset;
+    } else {
+        frozen->offsets[index] = offset;
+    }
+}
+
+static size_t varint_size(size_t value) {
+    size_t size = 1;
+    for (; value >= 0x80; value >>= 7) {
+        size++;
+    }
+    return size;
+}
+
+static char *put_varint(char *ptr, size_t value) {
+    for (; value >= 0x80; value >>= 7) {
+        *ptr++ = (char)(value | 0x80);
+    }
+    *ptr++ = (char)value;
+    return ptr;
+}
+
+static inline const char *get_varint(const char *ptr, size_t *value) {
+    size_t result = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = (uint8_t)*ptr++;
+        result |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return ptr;
+        }
+    }
+}
+
+void strings_frozen_free(struct strings_frozen *frozen) {
+    free(frozen->pilots);
+    free(frozen->remap);
+    free(frozen->slots);
+    free(frozen->data);
+    free(frozen->offsets);
+    free(frozen->wide_offsets);
+    free(frozen->decoded);
+    free(frozen->lengths);
+    free(frozen);
+}
+
+static bool alloc_data(struct strings_frozen *frozen, size_t bytes,
+                       size_t offsets) {
+    frozen->data = malloc(bytes ? bytes : 1);
+    frozen->data_size = bytes;
+    if (bytes > UINT32_MAX) {
+        frozen->wide_offsets = malloc(sizeof(uint64_t) * offsets);
+    } else {
+        frozen->offsets = malloc(sizeof(uint32_t) * offsets);
+    }
+    return frozen->data && (frozen->offsets || frozen->wide_offsets);
+}
+
+// Copy the strings and their offsets out of the repository
+static bool copy_strings(struct strings_frozen *frozen,
+                         const struct strings *strings) {
+    struct strings_cursor cursor;
+    size_t bytes = 0;
+    strings_cursor_init(&cursor, strings);
+    while (strings_cursor_next(&cursor)) {
+        bytes += strings_cursor_length(&cursor) + 1;
+    }
+    if (!alloc_data(frozen, bytes, (size_t)frozen->count + 1)) {
+        return false;
+    }
+    size_t offset = 0;
+    uint32_t index = 0;
+    strings_cursor_init(&cursor, strings);
+    while (strings_cursor_next(&cursor)) {
+        size_t len = strings_cursor_length(&cursor);
+        memcpy(frozen->data + offset, strings_cursor_string(&cursor), len + 1);
+        set_offset(frozen, index++, offset);
+        offset += len + 1;
+    }
+    set_offset(frozen, index, offset);
+    return true;
+}
+
+static size_t common_prefix(const char *a, size_t a_len, const char *b,
+                            size_t b_len) {
+    size_t len = a_len < b_len ? a_len : b_len;
+    size_t i = 0;
+    while (i < len && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+// Front-code the strings in the repository, and record the offset of each
+// run. The strings are walked twice: once to size the encoding, and once
+// to write it
+static bool front_code_strings(struct strings_frozen *frozen,
+                               const struct strings *strings) {
+    struct strings_cursor cursor;
+    size_t bytes = 0, max_len = 0, previous_len = 0;
+    const char *previous = NULL;
+    uint32_t index = 0;
+    strings_cursor_init(&cursor, strings);
+    for (; strings_cursor_next(&cursor); index++) {
+        const char *string = strings_cursor_string(&cursor);
+        size_t len = strings_cursor_length(&cursor);
+        size_t shared = index % run_size ?
+            common_prefix(previous, previous_len, string, len) : 0;
+        bytes += varint_size(shared) + varint_size(len - shared) +
+            len - shared;
+        if (len > max_len) {
+            max_len = len;
+        }
+        previous = string;
+        previous_len = len;
+    }
+    size_t runs = ((size_t)frozen->count + run_size - 1) / run_size;
+    frozen->layout = layout_front_coded;
+    frozen->decoded_size = max_len + 1;
+    frozen->decoded = malloc(frozen->decoded_size);
+    if (!frozen->decoded || !alloc_data(frozen, bytes, runs + 1)) {
+        return false;
+    }
+    char *ptr = frozen->data;
+    strings_cursor_init(&cursor, strings);
+    for (index = 0; strings_cursor_next(&cursor); index++) {
+        const char *string = strings_cursor_string(&cursor);
+        size_t len = strings_cursor_length(&cursor);
+        size_t shared = 0;
+        if (index % run_size) {
+            shared = common_prefix(previous, previous_len, string, len);
+        } else {
+            set_offset(frozen, index / run_size, ptr - frozen->data);
+        }
+        ptr = put_varint(ptr, shared);
+        ptr = put_varint(ptr, len - shared);
+        memcpy(ptr, string + shared, len - shared);
+        ptr += len - shared;
+        previous = string;
+        previous_len = len;
+    }
+    set_offset(frozen, runs, bytes);
+    return true;
+}
+
+// Strings are sorted with a radix sort on a key made from their last 8
+// bytes (reversed), and then runs with the same key are sorted by comparing
+// the rest of the strings, as in strings_sort()
+struct merge_entry {
+    uint64_t key;
+    const char *string;
+    uint32_t len;
+    uint32_t index;
+};
+
+static uint64_t reversed_key(const char *string, size_t len) {
+    uint64_t key = 0;
+    for (size_t i = 1; i <= 8; i++) {
+        key = key << 8 | (i <= len ? (uint8_t)string[len - i] : 0);
+    }
+    return key;
+}
+
+// Order strings by their reversed bytes, so that a string which is a suffix
+// of other strings is ordered directly before them
+static int compare_reversed(const void *a, const void *b) {
+    const struct merge_entry *x = a, *y = b;
+    const char *x_end = x->string + x->len, *y_end = y->string + y->len;
+    size_t len = x->len < y->len ? x->len : y->len;
+    for (size_t i = 1; i <= len; i++) {
+        if (x_end[-i] != y_end[-i]) {
+            return (uint8_t)x_end[-i] < (uint8_t)y_end[-i] ? -1 : 1;
+        }
+    }
+    return x->len < y->len ? -1 : x->len > y->len;
+}
+
+static bool sort_merge_entries(struct merge_entry *entries, size_t count) {
+    struct merge_entry *buffer = malloc(sizeof(*buffer) * (count + 1));
+    uint32_t *counts = malloc(sizeof(*counts) * 65536);
+    if (!buffer || !counts) {
+        free(buffer);
+        free(counts);
+        return false;
+    }
+    for (int shift = 0; shift < 64; shift += 16) {
+        memset(counts, 0, sizeof(*counts) * 65536);
+        for (size_t i = 0; i < count; i++) {
+            counts[(entries[i].key >> shift) & 0xFFFF]++;
+        }
+        uint32_t position = 0;
+        for (size_t digit = 0; digit < 65536; digit++) {
+            uint32_t digit_count = counts[digit];
+            counts[digit] = position;
+            position += digit_count;
+        }
+        for (size_t i = 0; i < count; i++) {
+            buffer[counts[(entries[i].key >> shift) & 0xFFFF]++] = entries[i];
+        }
+        struct merge_entry *swap = entries;
+        entries = buffer;
+        buffer = swap;
+    }
+    // There are an even number of passes, so the result is back in entries
+    free(buffer);
+    free(counts);
+    for (size_t i = 0; i < count;) {
+        size_t end = i + 1;
+        while (end < count && entries[end].key == entries[i].key) {
+            end++;
+        }
+        if (end - i > 1) {
+            qsort(entries + i, end - i, sizeof(*entries), compare_reversed);
+        }
+        i = end;
+    }
+    return true;
+}
+
+// Find the strings which are suffixes of other strings, and return the
+// number of bytes needed for the rest
+static size_t tail_merge_entries(struct strings_frozen *frozen,
+                                 struct merge_entry *entries, uint32_t count,
+                                 uint32_t *targets, size_t *deltas) {
+    size_t bytes = 0;
+    for (uint32_t i = count; i-- > 0;) {
+        const struct merge_entry *entry = &entries[i];
+        targets[entry->index] = entry->index;
+        deltas[entry->index] = 0;
+        if (i + 1 < count) {
+            // A string that's a suffix of the next string is stored at the
+            // end of the string that the next string is stored in
+            const struct merge_entry *next = &entries[i + 1];
+            size_t delta = next->len - entry->len;
+            if (next->len >= entry->len && !memcmp(next->string + delta,
+                                                   entry->string,
+                                                   entry->len)) {
+                targets[entry->index] = targets[next->index];
+                deltas[entry->index] = deltas[next->index] + delta;
+                frozen->merged_bytes += entry->len + 1;
+                continue;
+            }
+        }
+        bytes += entry->len + 1;
+    }
+    return bytes;
+}
+
+// Store the strings in the repository so that a string which is a suffix
+// of another string is stored inside it. Strings are sorted by their
+// reversed bytes to find suffixes, and the strings which aren't suffixes
+// are then stored in ID order. Strings with embedded NULL bytes are stored
+// without merging, since the strings merged into them would be cut short
+static bool tail_merge_strings(struct strings_frozen *frozen,
+                               const struct strings *strings) {
+    if (strings_compressed(strings)) {
+        return false;
+    }
+    uint32_t count = frozen->count;
+    struct merge_entry *entries = malloc(sizeof(*entries) * (count + 1));
+    uint32_t *targets = malloc(sizeof(*targets) * (count + 1));
+    size_t *deltas = malloc(sizeof(*deltas) * (count + 1));
+    frozen->layout = layout_tail_merged;
+    bool ok = entries && targets && deltas;
+    struct strings_cursor cursor;
+    uint32_t merged = 0, index = 0;
+    size_t bytes = 0;
+    strings_cursor_init(&cursor, strings);
+    for (; ok && strings_cursor_next(&cursor); index++) {
+        const char *string = strings_cursor_string(&cursor);
+        size_t len = strings_cursor_length(&cursor);
+        if (memchr(string, '\0', len)) {
+            targets[index] = index;
+            deltas[index] = 0;
+            bytes += len + 1;
+            frozen->length_count++;
+        } else {
+            struct merge_entry entry = {reversed_key(string, len), string,
+                                        len, index};
+            entries[merged++] = entry;
+        }
+    }
+    ok = ok && sort_merge_entries(entries, merged);
+    if (ok) {
+        bytes += tail_merge_entries(frozen, entries, merged, targets, deltas);
+        frozen->lengths = malloc(sizeof(*frozen->lengths) *
+                                 (frozen->length_count + 1));
+        ok = frozen->lengths && alloc_data(frozen, bytes, count + 1);
+    }
+    size_t offset = 0;
+    uint32_t length_count = 0;
+    strings_cursor_init(&cursor, strings);
+    for (index = 0; ok && strings_cursor_next(&cursor); index++) {
+        if (targets[index] != index) {
+            continue;
+        }
+        const char *string = strings_cursor_string(&cursor);
+        size_t len = strings_cursor_length(&cursor);
+        if (memchr(string, '\0', len)) {
+            struct frozen_length length = {index + 1, len};
+            frozen->lengths[length_count++] = length;
+        }
+        memcpy(frozen->data + offset, string, len + 1);
+        set_offset(frozen, index, offset);
+        offset += len + 1;
+    }
+    for (index = 0; ok && index < count; index++) {
+        if (targets[index] != index) {
+            set_offset(frozen, index, frozen_offset(frozen, targets[index]) +
+                       deltas[index]);
+        }
+    }
+    free(entries);
+    free(targets);
+    free(deltas);
+    return ok;
+}
+
+// Get the length of a tail-merged string
+static size_t merged_length(const struct strings_frozen *frozen,
+                            uint32_t id) {
+    uint32_t lo = 0, hi = frozen->length_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (frozen->lengths[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < frozen->length_count && frozen->lengths[lo].id == id) {
+        return frozen->lengths[lo].len;
+    }
+    return strlen(frozen->data + frozen_offset(frozen, id - 1));
+}
+
+// Get the length of a string which isn't front-coded
+static inline size_t stored_length(const struct strings_frozen *frozen,
+                                   uint32_t id) {
+    if (frozen->layout == layout_tail_merged) {
+        return merged_length(frozen, id);
+    }
+    return frozen_offset(frozen, id) - frozen_offset(frozen, id - 1) - 1;
+}
+
+// Decode a front-coded string into a buffer, returning its length. Each
+// string before it in its run is decoded on the way
+static size_t front_decode(const struct strings_frozen *frozen,
+                           uint32_t index, char *buffer) {
+    const char *ptr = frozen->data + frozen_offset(frozen, index / run_size);
+    for (uint32_t i = index - index % run_size;; i++) {
+        size_t shared, suffix;
+        ptr = get_varint(ptr, &shared);
+        ptr = get_varint(ptr, &suffix);
+        memcpy(buffer + shared, ptr, suffix);
+        if (i == index) {
+            buffer[shared + suffix] = '\0';
+            return shared + suffix;
+        }
+        ptr += suffix;
+    }
+}
+
+// Check whether a front-coded string is equal to another string, without
+// decoding it. This tracks the length of the prefix that each string in
+// the run shares with the other string: a string which shares more with
+// its predecessor than the predecessor matched can't match any further
+static bool front_equal(const struct strings_frozen *frozen, uint32_t index,
+                        const char *string, size_t len) {
+    const char *ptr = frozen->data + frozen_offset(frozen, index / run_size);
+    size_t matched = 0;
+    for (uint32_t i = index - index % run_size;; i++) {
+        size_t shared, suffix;
+        ptr = get_varint(ptr, &shared);
+        ptr = get_varint(ptr, &suffix);
+        if (shared <= matched) {
+            matched = shared;
+            while (matched < len && matched - shared < suffix &&
+                    ptr[matched - shared] == string[matched]) {
+                matched++;
+            }
+        }
+        if (i == index) {
+            return matched == len && shared + suffix == len;
+        }
+        ptr += suffix;
+    }
+}
+
+struct builder {
+    uint64_t *hashes;
+    // Strings (by index) grouped by bucket, with each bucket's range
+    uint32_t *members;
+    uint32_t *bucket_starts;
+    // Buckets in the order they are placed
+    uint32_t *order;
+    uint64_t *taken;
+    uint32_t *positions;
+};
+
+static void builder_free(struct builder *builder) {
+    free(builder->hashes);
+    free(builder->members);
+    free(builder->bucket_starts);
+    free(builder->order);
+    free(builder->taken);
+    free(builder->positions);
+}
+
+static inline bool is_taken(const uint64_t *taken, uint32_t slot) {
+    return taken[slot / 64] & (1ULL << (slot % 64));
+}
+
+static inline void set_taken(uint64_t *taken, uint32_t slot) {
+    taken[slot / 64] |= 1ULL << (slot % 64);
+}
+
+static inline void clear_taken(uint64_t *taken, uint32_t slot) {
+    taken[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+// Find a pilot for a bucket, and claim its slots. This function returns
+// false if no pilot works, e.g. because two strings have the same hash
+static bool place_bucket(struct strings_frozen *frozen,
+                         struct builder *builder, uint32_t bucket) {
+    uint32_t start = builder->bucket_starts[bucket];
+    uint32_t size = builder->bucket_starts[bucket + 1] - start;
+    const uint32_t *members = builder->members + start;
+    uint32_t *positions = builder->positions;
+    for (uint32_t i = 1; i < size; i++) {
+        for (uint32_t j = 0; j < i; j++) {
+            if (builder->hashes[members[i]] == builder->hashes[members[j]]) {
+                return false;
+            }
+        }
+    }
+    for (uint32_t pilot = 0;; pilot++) {
+        uint32_t placed = 0;
+        for (; placed < size; placed++) {
+            uint32_t slot = frozen_slot(frozen,
+                                        builder->hashes[members[placed]],
+                                        pilot);
+            if (is_taken(builder->taken, slot)) {
+                break;
+            }
+            // Slots are claimed as they're found, so that two strings in
+            // the bucket can't share one
+            set_taken(builder->taken, slot);
+            positions[placed] = slot;
+        }
+        if (placed == size) {
+            frozen->pilots[bucket] = pilot;
+            for (uint32_t i = 0; i < size; i++) {
+                uint64_t hash = builder->hashes[members[i]];
+                frozen->slots[positions[i]].fingerprint =
+                    frozen_fingerprint(hash);
+                frozen->slots[positions[i]].id = members[i] + 1;
+            }
+            return true;
+        }
+        while (placed--) {
+            clear_taken(builder->taken, positions[placed]);
+        }
+        if (pilot == max_pilot) {
+            return false;
+        }
+    }
+}
+
+// Build the perfect hash function with the current seed
+static bool build(struct strings_frozen *frozen, struct builder *builder,
+                  const struct strings *strings) {
+    uint32_t count = frozen->count;
+    uint32_t buckets = frozen->buckets;
+    memset(builder->bucket_starts, 0, sizeof(uint32_t) * (buckets + 1));
+    size_t taken_words = ((size_t)frozen->table_size + 63) / 64;
+    memset(builder->taken, 0, sizeof(uint64_t) * taken_words);
+    struct strings_cursor cursor;
+    strings_cursor_init(&cursor, strings);
+    for (uint32_t i = 0; strings_cursor_next(&cursor); i++) {
+        builder->hashes[i] = frozen_hash(strings_cursor_string(&cursor),
+                                         strings_cursor_length(&cursor),
+                                         frozen->seed);
+        builder->bucket_starts[frozen_bucket(frozen, builder->hashes[i]) + 1]++;
+    }
+
+    // Group strings by bucket, and count the buckets of each size
+    uint32_t max_size = 0;
+    for (uint32_t bucket = 0; bucket < buckets; bucket++) {
+        uint32_t size = builder->bucket_starts[bucket + 1];
+        if (size > max_size) {
+            max_size = size;
+        }
+        builder->bucket_starts[bucket + 1] += builder->bucket_starts[bucket];
+    }
+    uint32_t *sizes = calloc(max_size + 2, sizeof(*sizes));
+    if (!sizes) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t bucket = frozen_bucket(frozen, builder->hashes[i]);
+        builder->members[builder->bucket_starts[bucket]++] = i;
+    }
+    for (uint32_t bucket = buckets; bucket > 0; bucket--) {
+        builder->bucket_starts[bucket] = builder->bucket_starts[bucket - 1];
+    }
+    builder->bucket_starts[0] = 0;
+
+    // Sort buckets by size, largest first
+    for (uint32_t bucket = 0; bucket < buckets; bucket++) {
+        uint32_t size = builder->bucket_starts[bucket + 1] -
+            builder->bucket_starts[bucket];
+        sizes[max_size - size + 1]++;
+    }
+    for (uint32_t i = 1; i <= max_size + 1; i++) {
+        sizes[i] += sizes[i - 1];
+    }
+    for (uint32_t bucket = 0; bucket < buckets; bucket++) {
+        uint32_t size = builder->bucket_starts[bucket + 1] -
+            builder->bucket_starts[bucket];
+        builder->order[sizes[max_size - size]++] = bucket;
+    }
+    free(sizes);
+
+    for (uint32_t i = 0; i < buckets; i++) {
+        if (!place_bucket(frozen, builder, builder->order[i])) {
+            return false;
+        }
+    }
+
+    // Move strings out of the extra slots. There are as many of these as
+    // there are free slots below count
+    uint32_t free_slot = 0;
+    for (uint32_t slot = count; slot < frozen->table_size; slot++) {
+        if (!is_taken(builder->taken, slot)) {
+            continue;
+        }
+        while (is_taken(builder->taken, free_slot)) {
+            free_slot++;
+        }
+        frozen->remap[slot - count] = free_slot;
+        frozen->slots[free_slot++] = frozen->slots[slot];
+    }
+    return true;
+}
+
+static struct strings_frozen *freeze(const struct strings *strings,
+                                     enum frozen_layout layout) {
+    struct strings_frozen *frozen = calloc(1, sizeof(*frozen));
+    if (!frozen) {
+        return NULL;
+    }
+    uint32_t count = strings_count(strings);
+    frozen->count = count;
+    frozen->table_size = count + count / extra_slots_divisor + 1;
+    frozen->buckets = count / bucket_size + 2;
+    frozen->dense_buckets = (uint64_t)frozen->buckets *
+        dense_buckets_percent / 100 + 1;
+    frozen->pilots = calloc(frozen->buckets, sizeof(*frozen->pilots));
+    frozen->remap = calloc(frozen->table_size - count,
+                           sizeof(*frozen->remap));
+    frozen->slots = calloc(frozen->table_size, sizeof(*frozen->slots));
+    bool copied;
+    if (layout == layout_front_coded) {
+        copied = front_code_strings(frozen, strings);
+    } else if (layout == layout_tail_merged) {
+        copied = tail_merge_strings(frozen, strings);
+    } else {
+        copied = copy_strings(frozen, strings);
+    }
+    if (!frozen->pilots || !frozen->remap || !frozen->slots || !copied) {
+        strings_frozen_free(frozen);
+        return NULL;
+    }
+    if (!count) {
+        return frozen;
+    }
+
+    struct builder builder;
+    builder.hashes = malloc(sizeof(uint64_t) * count);
+    builder.members = malloc(sizeof(uint32_t) * count);
+    builder.bucket_starts = malloc(sizeof(uint32_t) * (frozen->buckets + 1));
+    builder.order = malloc(sizeof(uint32_t) * frozen->buckets);
+    builder.taken = malloc(sizeof(uint64_t) *
+                           (((size_t)frozen->table_size + 63) / 64));
+    builder.positions = malloc(sizeof(uint32_t) * count);
+    bool ok = builder.hashes && builder.members && builder.bucket_starts &&
+        builder.order && builder.taken && builder.positions;
+    frozen->seed = 5381;
+    for (int attempt = 1; ok && !build(frozen, &builder, strings);
+            attempt++) {
+        ok = attempt < max_attempts;
+        frozen->seed = mix(frozen->seed);
+    }
+    builder_free(&builder);
+    if (!ok) {
+        strings_frozen_free(frozen);
+        return NULL;
+    }
+    struct frozen_slot *slots = realloc(frozen->slots,
+                                        sizeof(*slots) * count);
+    if (slots) {
+        frozen->slots = slots;
+    }
+    return frozen;
+}
+
+struct strings_frozen *strings_freeze(const struct strings *strings) {
+    return freeze(strings, layout_plain);
+}
+
+struct strings_frozen *strings_freeze_front_coded(
+        const struct strings *strings) {
+    return freeze(strings, layout_front_coded);
+}
+
+struct strings_frozen *strings_freeze_tail_merged(
+        const struct strings *strings) {
+    return freeze(strings, layout_tail_merged);
+}
+
+uint32_t strings_frozen_count(const struct strings_frozen *frozen) {
+    return frozen->count;
+}
+
+uint32_t strings_frozen_lookup_len(const struct strings_frozen *frozen,
+                                   const char *string, size_t len) {
+    uint32_t id = inline_id(string, len);
+    if (id || !frozen->count) {
+        return id;
+    }
+    uint64_t hash = frozen_hash(string, len, frozen->seed);
+    uint32_t pilot = frozen->pilots[frozen_bucket(frozen, hash)];
+    uint32_t position = frozen_slot(frozen, hash, pilot);
+    if (position >= frozen->count) {
+        position = frozen->remap[position - frozen->count];
+    }
+    const struct frozen_slot *slot = &frozen->slots[position];
+    if (slot->fingerprint != frozen_fingerprint(hash)) {
+        return 0;
+    }
+    // Every string maps to some slot, so a match must still be confirmed
+    if (frozen->layout == layout_front_coded) {
+        return front_equal(frozen, slot->id - 1, string, len) ? slot->id : 0;
+    }
+    if (stored_length(frozen, slot->id) != len ||
+            memcmp(frozen->data + frozen_offset(frozen, slot->id - 1), string,
+                   len)) {
+        return 0;
+    }
+    return slot->id;
+}
+
+uint32_t strings_frozen_lookup(const struct strings_frozen *frozen,
+                               const char *string) {
+    return strings_frozen_lookup_len(frozen, string, strlen(string));
+}
+
+const char *strings_frozen_lookup_id_len(struct strings_frozen *frozen,
+                                         uint32_t id, size_t *len) {
+#ifdef INLINE_UNSIGNED
+    if (id & unsigned_tag) {
+        *len = unsigned_string(frozen->buffer, id & ~unsigned_tag);
+        return frozen->buffer;
+    }
+#endif
+
+    if (!id || id > frozen->count) {
+        return NULL;
+    }
+    if (frozen->layout == layout_front_coded) {
+        *len = front_decode(frozen, id - 1, frozen->decoded);
+        return frozen->decoded;
+    }
+    *len = stored_length(frozen, id);
+    return frozen->data + frozen_offset(frozen, id - 1);
+}
+
+const char *strings_frozen_lookup_id(struct strings_frozen *frozen,
+                                     uint32_t id) {
+    size_t len;
+    return strings_frozen_lookup_id_len(frozen, id, &len);
+}
+
+size_t strings_frozen_allocated_bytes(const struct strings_frozen *frozen) {
+    size_t offset_size = frozen->wide_offsets ? sizeof(uint64_t) :
+        sizeof(uint32_t);
+    size_t offsets = (size_t)frozen->count + 1;
+    size_t decoded = 0;
+    if (frozen->layout == layout_front_coded) {
+        offsets = ((size_t)frozen->count + run_size - 1) / run_size + 1;
+        decoded = frozen->decoded_size;
+    }
+    return frozen->buckets * sizeof(*frozen->pilots) +
+        (frozen->table_size - frozen->count) * sizeof(*frozen->remap) +
+        frozen->count * sizeof(*frozen->slots) +
+        frozen->data_size + offsets * offset_size + decoded +
+        frozen->length_count * sizeof(*frozen->lengths) +
+        sizeof(*frozen);
+}
+
+size_t strings_frozen_merged_bytes(const struct strings_frozen *frozen) {
+    return frozen->merged_bytes;
+}
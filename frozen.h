@@ -0,0 +1,73 @@
+#ifndef INTERN_FROZEN_H_
+#define INTERN_FROZEN_H_
+
+#include "strings.h"
+
+// A frozen repository is an immutable copy of a repository, for
+// dictionaries that are built once and then only queried. Strings are found
+// with a minimal perfect hash function, which maps each string to its own
+// slot with no empty slots and no probing. Each slot holds a fingerprint,
+// so that most strings which aren't in the repository are rejected without
+// touching string data, and the string's ID. Strings are stored back to
+// back in ID order with a packed array of offsets. The index uses ~9 bytes
+// per string, and the strings themselves one byte more than their length.
+// IDs are the same as in the repository that was frozen. A frozen
+// repository is never modified, so any number of threads can look strings
+// up at once (apart from the buffer used for inlined unsigned integers)
+struct strings_frozen;
+
+// Freeze a repository. This takes time roughly proportional to the number
+// of strings. The repository is not modified, and can be freed afterwards.
+// This function returns NULL if an error occurred
+struct strings_frozen *strings_freeze(const struct strings*);
+
+// Freeze a repository with its strings front-coded: strings are stored in
+// small runs, and each string after the first in a run only stores the
+// bytes which follow the prefix it shares with the string before it. This
+// takes much less memory when strings with IDs next to each other share
+// long prefixes, e.g. URLs or hierarchical names in a repository sorted
+// with strings_sort(). Looking up a string's ID compares it with the stored
+// string as the run is decoded, and looking up an ID decodes part of its
+// run into an internal buffer. That buffer is overwritten by the next
+// lookup, so strings_frozen_lookup_id() must not be called from more than
+// one thread at a time. This function returns NULL if an error occurred
+struct strings_frozen *strings_freeze_front_coded(const struct strings*);
+
+// Freeze a repository with its strings tail-merged: a string which is a
+// suffix of another string (e.g. a domain and its subdomains, or a file
+// name and a path) is not stored, and points into the longer string
+// instead. Lengths are found with strlen() rather than being implied, so
+// looking up an ID costs time proportional to the string's length. Finding
+// suffixes takes time roughly proportional to n log n, and needs every
+// string at once, so repositories with compressed strings can't be frozen
+// this way. This function returns NULL if an error occurred
+struct strings_frozen *strings_freeze_tail_merged(const struct strings*);
+
+// Free a frozen repository
+void strings_frozen_free(struct strings_frozen*);
+
+// Count the number of unique strings
+uint32_t strings_frozen_count(const struct strings_frozen*);
+
+// Lookup the ID for a string. This function returns zero if the string
+// does not exist in the repository
+uint32_t strings_frozen_lookup(const struct strings_frozen*,
+                               const char *string);
+uint32_t strings_frozen_lookup_len(const struct strings_frozen*,
+                                   const char *string, size_t len);
+
+// Lookup the string associated with an ID, as with strings_lookup_id().
+// Inlined unsigned integers (and front-coded strings) are written into an
+// internal buffer, as with a regular repository
+const char *strings_frozen_lookup_id(struct strings_frozen*, uint32_t id);
+const char *strings_frozen_lookup_id_len(struct strings_frozen*, uint32_t id,
+                                         size_t *len);
+
+// Get the total bytes allocated, including overhead
+size_t strings_frozen_allocated_bytes(const struct strings_frozen*);
+
+// Get the number of bytes of string data that tail merging saved. This is
+// zero unless the repository was frozen with strings_freeze_tail_merged()
+size_t strings_frozen_merged_bytes(const struct strings_frozen*);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef INTERN_GROUP_H_
+#define INTERN_GROUP_H_
+
+// Control byte groups for the open-addressing hash table. Each slot in the
+// table has a control byte which is either empty, deleted, or holds a 7-bit
+// tag taken from the hash of the string in the slot. Control bytes are
+// probed a group at a time, so a single word comparison filters eight slots
+
+#include <stdint.h>
+#include <string.h>
+
+#define GROUP_WIDTH 8
+
+static const uint8_t ctrl_empty = 0x80;
+static const uint8_t ctrl_deleted = 0xFE;
+
+static const uint64_t group_lsbs = 0x0101010101010101ULL;
+static const uint64_t group_msbs = 0x8080808080808080ULL;
+
+static inline uint64_t group_load(const uint8_t *ctrl) {
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof(group));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group);
+#endif
+    return group;
+}
+
+// Load a group which may be written by another thread. Control bytes are
+// stored with release semantics after their slot has been written, so the
+// slot behind any full control byte seen here is safe to read. Groups are
+// always aligned, since tables are allocated a group at a time
+static inline uint64_t group_load_acquire(const uint8_t *ctrl) {
+    uint64_t group = __atomic_load_n((const uint64_t *)ctrl, __ATOMIC_ACQUIRE);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group);
+#endif
+    return group;
+}
+
+// Set one control byte in a group, publishing the whole group with release
+// semantics so that it pairs with group_load_acquire(). There must only be
+// one thread writing to the table
+static inline void group_set_release(uint8_t *ctrl, size_t index,
+                                     uint8_t value) {
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof(group));
+    memcpy((uint8_t *)&group + index, &value, sizeof(value));
+    __atomic_store_n((uint64_t *)ctrl, group, __ATOMIC_RELEASE);
+}
+
+// Get a mask of slots whose tag matches. This can return false positives,
+// but only for full slots, so callers must still compare the hash
+static inline uint64_t group_match(uint64_t group, uint8_t tag) {
+    uint64_t x = group ^ (group_lsbs * tag);
+    return (x - group_lsbs) & ~x & group_msbs;
+}
+
+static inline uint64_t group_match_empty(uint64_t group) {
+    return group & ~(group << 6) & group_msbs;
+}
+
+static inline uint64_t group_match_empty_or_deleted(uint64_t group) {
+    return group & group_msbs;
+}
+
+static inline uint64_t group_match_full(uint64_t group) {
+    return ~group & group_msbs;
+}
+
+// Get the index of the lowest slot in a mask
+static inline size_t group_mask_index(uint64_t mask) {
+    return (size_t)__builtin_ctzll(mask) >> 3;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef INTERN_HASH_H_
+#define INTERN_HASH_H_
+
+// String hash functions. The default is wyhash, which hashes 16 to 48
+// bytes per step and produces a 64-bit result. The legacy DJB2 hash can be
+// selected at compile time with DJB2_HASH, but wyhash() is always available
+// for hashes that need every bit to depend on the seed
+//
+// wyhash (final version 4) is by Wang Yi - https://github.com/wangyi-fudan/wyhash
+
+#include <stdint.h>
+#include <string.h>
+
+static const uint64_t wyhash_secret[4] = {
+    0x2D358DCCAA6C78A5ULL, 0x8BB84B93962EACC9ULL,
+    0x4B33A62ED433D4A3ULL, 0x4D5A2DA51DE1AA47ULL
+};
+
+static inline void wyhash_mum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline uint64_t wyhash_mix(uint64_t a, uint64_t b) {
+    wyhash_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wyhash_read8(const uint8_t *ptr) {
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline uint64_t wyhash_read4(const uint8_t *ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline uint64_t wyhash(const char *string, size_t len,
+                              uint64_t seed) {
+    const uint8_t *ptr = (const uint8_t *)string;
+    const uint64_t *secret = wyhash_secret;
+    uint64_t a, b;
+    seed ^= wyhash_mix(seed ^ secret[0], secret[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t step = (len >> 3) << 2;
+            a = (wyhash_read4(ptr) << 32) | wyhash_read4(ptr + step);
+            b = (wyhash_read4(ptr + len - 4) << 32) |
+                wyhash_read4(ptr + len - 4 - step);
+        } else if (len > 0) {
+            a = ((uint64_t)ptr[0] << 16) | ((uint64_t)ptr[len >> 1] << 8) |
+                ptr[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = wyhash_mix(wyhash_read8(ptr) ^ secret[1],
+                                  wyhash_read8(ptr + 8) ^ seed);
+                seed1 = wyhash_mix(wyhash_read8(ptr + 16) ^ secret[2],
+                                   wyhash_read8(ptr + 24) ^ seed1);
+                seed2 = wyhash_mix(wyhash_read8(ptr + 32) ^ secret[3],
+                                   wyhash_read8(ptr + 40) ^ seed2);
+                ptr += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = wyhash_mix(wyhash_read8(ptr) ^ secret[1],
+                              wyhash_read8(ptr + 8) ^ seed);
+            i -= 16;
+            ptr += 16;
+        }
+        a = wyhash_read8(ptr + i - 16);
+        b = wyhash_read8(ptr + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    wyhash_mum(&a, &b);
+    return wyhash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+#ifdef DJB2_HASH
+
+// DJB2 only produces 32 bits, so the result is passed through a 64-bit
+// finalizer to spread it over every bit of the hash
+static inline uint64_t hash_string(const char *string, size_t len,
+                                   uint64_t seed) {
+    uint32_t hash = (uint32_t)seed;
+    for (size_t i = 0; i < len; i++) {
+        hash = ((hash << 5) + hash) + (uint32_t)string[i];
+    }
+    uint64_t mixed = hash;
+    mixed ^= mixed >> 33;
+    mixed *= 0xFF51AFD7ED558CCDULL;
+    mixed ^= mixed >> 33;
+    mixed *= 0xC4CEB9FE1A85EC53ULL;
+    mixed ^= mixed >> 33;
+    return mixed;
+}
+
+#else
+
+static inline uint64_t hash_string(const char *string, size_t len,
+                                   uint64_t seed) {
+    return wyhash(string, len, seed);
+}
+
+#endif
+
+// SipHash-1-3, a keyed hash which is used when the repository must resist
+// hash flooding. SipHash is by Jean-Philippe Aumasson and Daniel J. Bernstein
+
+#define SIPHASH_ROTATE(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPHASH_ROUND(v0, v1, v2, v3) do { \
+    v0 += v1; v1 = SIPHASH_ROTATE(v1, 13); v1 ^= v0; \
+    v0 = SIPHASH_ROTATE(v0, 32); \
+    v2 += v3; v3 = SIPHASH_ROTATE(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = SIPHASH_ROTATE(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = SIPHASH_ROTATE(v1, 17); v1 ^= v2; \
+    v2 = SIPHASH_ROTATE(v2, 32); \
+} while (0)
+
+static inline uint64_t siphash_read8(const uint8_t *ptr) {
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline uint64_t hash_string_keyed(const char *string, size_t len,
+                                         const uint64_t key[2]) {
+    const uint8_t *ptr = (const uint8_t *)string;
+    uint64_t v0 = 0x736F6D6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646F72616E646F6DULL ^ key[1];
+    uint64_t v2 = 0x6C7967656E657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+    const uint8_t *end = ptr + (len & ~(size_t)7);
+    for (; ptr != end; ptr += 8) {
+        uint64_t m = siphash_read8(ptr);
+        v3 ^= m;
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    uint64_t b = (uint64_t)len << 56;
+    switch (len & 7) {
+        case 7: b |= (uint64_t)ptr[6] << 48; // fallthrough
+        case 6: b |= (uint64_t)ptr[5] << 40; // fallthrough
+        case 5: b |= (uint64_t)ptr[4] << 32; // fallthrough
+        case 4: b |= (uint64_t)ptr[3] << 24; // fallthrough
+        case 3: b |= (uint64_t)ptr[2] << 16; // fallthrough
+        case 2: b |= (uint64_t)ptr[1] << 8;  // fallthrough
+        case 1: b |= (uint64_t)ptr[0];
+    }
+    v3 ^= b;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xFF;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef INTERN_INLINE_H_
+#define INTERN_INLINE_H_
+
+// Unsigned integers can be inlined into IDs rather than being stored (see
+// INLINE_UNSIGNED). Inlined IDs have the high bit set, which limits the
+// number of IDs that can be stored
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef INLINE_UNSIGNED
+#include "unsigned.h"
+
+const static uint32_t unsigned_tag = 0x80000000;
+const static uint32_t id_overflow = 0x80000000;
+
+static int is_small_unsigned(const char *string, size_t len) {
+    if (!len || len > 10) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (string[i] < '0' || string[i] > '9') {
+            return false;
+        }
+    }
+    return len < 10 || string[0] <= '2';
+}
+
+static uint32_t to_unsigned(const char *string, size_t len) {
+    uint32_t number = 0;
+    for (size_t i = 0; i < len; i++) {
+        number = number * 10 + (string[i] - '0');
+    }
+    return number;
+}
+
+// Get the inlined ID for a string, or zero if it can't be inlined
+static inline uint32_t inline_id(const char *string, size_t len) {
+    if (is_small_unsigned(string, len)) {
+        uint32_t number = to_unsigned(string, len);
+        if (number < unsigned_tag) {
+            return number | unsigned_tag;
+        }
+    }
+    return 0;
+}
+
+#else
+const static uint32_t id_overflow = 0;
+
+static inline uint32_t inline_id(const char *string, size_t len) {
+    return 0;
+}
+#endif
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef INTERN_LZ_H_
+#define INTERN_LZ_H_
+
+// A small LZ77 codec in the style of LZ4, used to compress pages of string
+// data. Compressed data is a series of sequences, each of which is a token
+// byte, the literals, a 2-byte little-endian offset back to a match, and
+// the match. The high 4 bits of the token are the number of literals and
+// the low 4 bits are the match length minus 4, and a value of 15 is
+// continued in the following bytes (after the token and after the offset,
+// respectively), which are added up until a byte other than 255. The last
+// sequence has only literals. Matches are found with a single hash table
+// of recent positions, which favours speed over ratio
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+
+static const size_t lz_min_match = 4;
+static const size_t lz_max_offset = 65535;
+
+static inline uint32_t lz_read32(const uint8_t *ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline uint32_t lz_hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Write the continuation of a length. This returns NULL if the output is
+// full
+static uint8_t *lz_put_length(uint8_t *out, const uint8_t *out_end,
+                              size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (out == out_end) {
+            return NULL;
+        }
+        *out++ = 255;
+    }
+    if (out == out_end) {
+        return NULL;
+    }
+    *out++ = (uint8_t)len;
+    return out;
+}
+
+// Write a sequence. A match length of zero ends the data
+static uint8_t *lz_put_sequence(uint8_t *out, const uint8_t *out_end,
+                                const uint8_t *literals, size_t literal_len,
+                                size_t offset, size_t match_len) {
+    if (out == out_end) {
+        return NULL;
+    }
+    size_t match_code = match_len ? match_len - lz_min_match : 0;
+    uint8_t *token = out++;
+    *token = (uint8_t)((literal_len < 15 ? literal_len : 15) << 4 |
+                       (match_code < 15 ? match_code : 15));
+    if (literal_len >= 15) {
+        out = lz_put_length(out, out_end, literal_len - 15);
+        if (!out) {
+            return NULL;
+        }
+    }
+    if ((size_t)(out_end - out) < literal_len) {
+        return NULL;
+    }
+    memcpy(out, literals, literal_len);
+    out += literal_len;
+    if (!match_len) {
+        return out;
+    }
+    if (out_end - out < 2) {
+        return NULL;
+    }
+    *out++ = (uint8_t)offset;
+    *out++ = (uint8_t)(offset >> 8);
+    if (match_code >= 15) {
+        out = lz_put_length(out, out_end, match_code - 15);
+    }
+    return out;
+}
+
+// Compress len bytes into dest. This function returns the compressed size,
+// or zero if it would be more than capacity bytes
+static size_t lz_compress(const void *src, size_t len, void *dest,
+                          size_t capacity) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const uint8_t *in = src;
+    const uint8_t *end = in + len;
+    const uint8_t *position = in;
+    const uint8_t *anchor = in;
+    uint8_t *out = dest;
+    const uint8_t *out_end = out + capacity;
+    while (end - position >= (ptrdiff_t)lz_min_match) {
+        uint32_t value = lz_read32(position);
+        uint32_t *entry = &table[lz_hash(value)];
+        const uint8_t *match = in + *entry;
+        *entry = (uint32_t)(position - in);
+        if (match >= position || (size_t)(position - match) > lz_max_offset ||
+                lz_read32(match) != value) {
+            position++;
+            continue;
+        }
+        size_t match_len = lz_min_match;
+        while (position + match_len < end &&
+                match[match_len] == position[match_len]) {
+            match_len++;
+        }
+        out = lz_put_sequence(out, out_end, anchor, position - anchor,
+                              position - match, match_len);
+        if (!out) {
+            return 0;
+        }
+        position += match_len;
+        anchor = position;
+    }
+    out = lz_put_sequence(out, out_end, anchor, end - anchor, 0, 0);
+    return out ? (size_t)(out - (uint8_t *)dest) : 0;
+}
+
+// Read the continuation of a length. This returns NULL if the input ends
+static const uint8_t *lz_get_length(const uint8_t *in, const uint8_t *in_end,
+                                    size_t *len) {
+    uint8_t byte;
+    do {
+        if (in == in_end) {
+            return NULL;
+        }
+        byte = *in++;
+        *len += byte;
+    } while (byte == 255);
+    return in;
+}
+
+// Decompress len bytes from src into dest, which must decompress to exactly
+// capacity bytes. This function returns false if the data is corrupt
+static bool lz_decompress(const void *src, size_t len, void *dest,
+                          size_t capacity) {
+    const uint8_t *in = src;
+    const uint8_t *in_end = in + len;
+    uint8_t *out = dest;
+    uint8_t *out_end = out + capacity;
+    while (in < in_end) {
+        uint8_t token = *in++;
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 &&
+                !(in = lz_get_length(in, in_end, &literal_len))) {
+            return false;
+        }
+        if ((size_t)(in_end - in) < literal_len ||
+                (size_t)(out_end - out) < literal_len) {
+            return false;
+        }
+        memcpy(out, in, literal_len);
+        in += literal_len;
+        out += literal_len;
+        if (in == in_end) {
+            break;
+        }
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !(in = lz_get_length(in, in_end, &match_len))) {
+            return false;
+        }
+        match_len += lz_min_match;
+        if (!offset || offset > (size_t)(out - (uint8_t *)dest) ||
+                (size_t)(out_end - out) < match_len) {
+            return false;
+        }
+        // Matches can overlap the bytes they produce, e.g. runs of a byte
+        const uint8_t *match = out - offset;
+        if (offset >= match_len) {
+            memcpy(out, match, match_len);
+        } else {
+            for (size_t i = 0; i < match_len; i++) {
+                out[i] = match[i];
+            }
+        }
+        out += match_len;
+    }
+    return out == out_end;
+}
+
+#endif
@@ -61,28 +61,64 @@ static bool resize_counts(struct strings_frequency *frequency,
     return true;
 }
 
-static int count_comparator(const void *a_, const void *b_) {
-    const struct id_count *a = (const struct id_count *)a_;
-    const struct id_count *b = (const struct id_count *)b_;
-    return b->count > a->count ? 1 : (a->count > b->count ? -1 : 0);
-}
-
-static int id_comparator(const void *a_, const void *b_) {
-    const struct id_count *a = (const struct id_count *)a_;
-    const struct id_count *b = (const struct id_count *)b_;
-    return b->id > a->id ? -1 : (a->id > b->id ? 1 : 0);
-}
-
-static void sort_by_count(struct strings_frequency *frequency) {
+// Sort counts in descending order with a stable LSD radix sort, 16 bits at
+// a time, so that strings seen equally often stay in ID order. A pass is
+// skipped if every count has the same digit, which makes the second pass
+// free unless some string was seen 65536 times or more
+static bool sort_by_count(struct strings_frequency *frequency) {
+    size_t n = frequency->max_id;
+    struct id_count *counts = frequency->counts;
+    size_t digits = 1 << 16;
+    struct id_count *scratch = malloc(sizeof(*scratch) * (n ? n : 1));
+    size_t *offsets = malloc(sizeof(*offsets) * digits);
+    if (!scratch || !offsets) {
+        free(scratch);
+        free(offsets);
+        return false;
+    }
+    for (unsigned shift = 0; shift < 32; shift += 16) {
+        memset(offsets, 0, sizeof(*offsets) * digits);
+        for (size_t i = 0; i < n; i++) {
+            offsets[(uint16_t)(~counts[i].count >> shift)]++;
+        }
+        if (n && offsets[(uint16_t)(~counts[0].count >> shift)] == n) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t digit = 0; digit < digits; digit++) {
+            size_t digit_count = offsets[digit];
+            offsets[digit] = offset;
+            offset += digit_count;
+        }
+        for (size_t i = 0; i < n; i++) {
+            scratch[offsets[(uint16_t)(~counts[i].count >> shift)]++] =
+                counts[i];
+        }
+        struct id_count *swap = counts;
+        counts = scratch;
+        scratch = swap;
+    }
+    if (counts != frequency->counts) {
+        memcpy(frequency->counts, counts, sizeof(*counts) * n);
+        scratch = counts;
+    }
+    free(scratch);
+    free(offsets);
     frequency->sorted_by_count = true;
-    qsort(frequency->counts, frequency->max_id, sizeof(struct id_count),
-          count_comparator);
+    return true;
 }
 
+// IDs are 1 to max_id, so each count can be swapped straight into place
 static void sort_by_id(struct strings_frequency *frequency) {
     frequency->sorted_by_count = false;
-    qsort(frequency->counts, frequency->max_id, sizeof(struct id_count),
-          id_comparator);
+    struct id_count *counts = frequency->counts;
+    for (uint32_t i = 0; i < frequency->max_id; i++) {
+        while (counts[i].id != i + 1) {
+            struct id_count id_count = counts[counts[i].id - 1];
+            counts[counts[i].id - 1] = counts[i];
+            counts[i] = id_count;
+        }
+    }
 }
 
 bool strings_frequency_add(struct strings_frequency *frequency, uint32_t id) {
@@ -127,30 +163,33 @@ bool strings_frequency_add_all(struct strings_frequency *frequency,
 
 struct strings *strings_optimize(struct strings *strings,
                                  struct strings_frequency *frequency) {
-    struct strings *optimized = strings_new();
-    if (!optimized) {
-        return NULL;
-    }
+    return strings_optimize_remap(strings, frequency, NULL);
+}
 
+struct strings *strings_optimize_remap(struct strings *strings,
+                                       struct strings_frequency *frequency,
+                                       uint32_t *remap) {
     if (!frequency->sorted_by_count) {
         for (uint32_t i = 0; i < frequency->max_id; i++) {
             frequency->counts[i].id = i + 1;
         }
-        sort_by_count(frequency);
+        if (!sort_by_count(frequency)) {
+            return NULL;
+        }
     }
 
-    for (uint32_t i = 0; i < frequency->max_id; i++) {
-        const struct id_count *id_count = &frequency->counts[i];
-        if (!id_count->count) {
-            break;
-        }
-        const char *string = strings_lookup_id(strings, id_count->id);
-        if (!string || !strings_intern(optimized, string)) {
-            goto error;
-        }
+    uint32_t count = 0;
+    while (count < frequency->max_id && frequency->counts[count].count) {
+        count++;
+    }
+    uint32_t *ids = malloc(sizeof(*ids) * (count ? count : 1));
+    if (!ids) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        ids[i] = frequency->counts[i].id;
     }
+    struct strings *optimized = strings_reorder(strings, ids, count, remap);
+    free(ids);
     return optimized;
-error:
-    strings_free(optimized);
-    return NULL;
 }
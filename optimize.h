@@ -10,6 +10,16 @@ struct strings_frequency;
 // frequently seen string
 struct strings *strings_optimize(struct strings*, struct strings_frequency*);
 
+// Create an optimized repository as with strings_optimize(), and write a
+// mapping from old IDs to new IDs so that stored IDs can be rewritten. remap
+// must have room for strings_count() + 1 IDs, and remap[id] is set to the
+// new ID of the string with each old ID, or zero if the string was never
+// seen and so isn't in the optimized repository. Strings are copied with
+// their hashes rather than interned again (see strings_reorder())
+struct strings *strings_optimize_remap(struct strings*,
+                                       struct strings_frequency*,
+                                       uint32_t *remap);
+
 // Create a new string frequency tracker
 struct strings_frequency *strings_frequency_new(void);
 
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "config.h"
+#include "queue.h"
+
+// The maximum number of requests interned together by the queue's thread
+#define QUEUE_BATCH 256
+
+// The number of times to yield before sleeping when waiting
+static const int spin_limit = 64;
+
+// Each cell has a sequence number which tells producers and the consumer
+// whose turn it is. A cell at position p is free for the producer that
+// claims position p when its sequence is p, and holds a request for the
+// consumer when its sequence is p + 1
+struct cell {
+    size_t sequence;
+    struct strings_request *request;
+};
+
+struct strings_queue {
+    struct strings *strings;
+    struct cell *cells;
+    size_t mask;
+    size_t head;
+    size_t tail;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int sleeping;
+    int waiters;
+    int stop;
+};
+
+static bool queue_empty(const struct strings_queue *queue) {
+    const struct cell *cell = &queue->cells[queue->tail & queue->mask];
+    return __atomic_load_n(&cell->sequence, __ATOMIC_SEQ_CST) !=
+        queue->tail + 1;
+}
+
+// Take up to QUEUE_BATCH requests from the ring. Only the queue's thread
+// consumes, so the tail is not shared
+static size_t dequeue(struct strings_queue *queue,
+                      struct strings_request **requests) {
+    size_t count = 0;
+    while (count < QUEUE_BATCH) {
+        struct cell *cell = &queue->cells[queue->tail & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        if (sequence != queue->tail + 1) {
+            break;
+        }
+        requests[count++] = cell->request;
+        __atomic_store_n(&cell->sequence, queue->tail + queue->mask + 1,
+                         __ATOMIC_RELEASE);
+        queue->tail++;
+    }
+    return count;
+}
+
+// Sleep until there are requests, or the queue is stopping. Producers wake
+// the thread when they see that it is sleeping
+static void wait_for_work(struct strings_queue *queue) {
+    for (int i = 0; i < spin_limit; i++) {
+        if (!queue_empty(queue)) {
+            return;
+        }
+        sched_yield();
+    }
+    pthread_mutex_lock(&queue->lock);
+    __atomic_store_n(&queue->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (queue_empty(queue) &&
+            !__atomic_load_n(&queue->stop, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&queue->work, &queue->lock);
+    }
+    __atomic_store_n(&queue->sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void *queue_thread(void *arg) {
+    struct strings_queue *queue = arg;
+    struct strings_request *requests[QUEUE_BATCH];
+    const char *strings[QUEUE_BATCH];
+    size_t lens[QUEUE_BATCH];
+    uint32_t ids[QUEUE_BATCH];
+    for (;;) {
+        size_t count = dequeue(queue, requests);
+        if (!count) {
+            if (__atomic_load_n(&queue->stop, __ATOMIC_SEQ_CST) &&
+                    queue_empty(queue)) {
+                break;
+            }
+            wait_for_work(queue);
+            continue;
+        }
+        for (size_t i = 0; i < count; i++) {
+            strings[i] = requests[i]->string;
+            lens[i] = requests[i]->len;
+        }
+        strings_intern_batch(queue->strings, strings, lens, ids, count);
+        for (size_t i = 0; i < count; i++) {
+            requests[i]->id = ids[i];
+            __atomic_store_n(&requests[i]->done, 1, __ATOMIC_SEQ_CST);
+        }
+        // Completion is signalled once per batch, and only if a thread
+        // has given up spinning
+        if (__atomic_load_n(&queue->waiters, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&queue->lock);
+            pthread_cond_broadcast(&queue->done);
+            pthread_mutex_unlock(&queue->lock);
+        }
+    }
+    return NULL;
+}
+
+struct strings_queue *strings_queue_new(struct strings *strings,
+                                        size_t capacity) {
+    struct strings_queue *queue = malloc(sizeof(*queue));
+    if (!queue) {
+        return NULL;
+    }
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    queue->cells = malloc(sizeof(*queue->cells) * size);
+    if (!queue->cells) {
+        free(queue);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; i++) {
+        queue->cells[i].sequence = i;
+    }
+    queue->strings = strings;
+    queue->mask = size - 1;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->sleeping = 0;
+    queue->waiters = 0;
+    queue->stop = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work, NULL);
+    pthread_cond_init(&queue->done, NULL);
+    if (pthread_create(&queue->thread, NULL, queue_thread, queue)) {
+        pthread_cond_destroy(&queue->done);
+        pthread_cond_destroy(&queue->work);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue->cells);
+        free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+void strings_queue_free(struct strings_queue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    __atomic_store_n(&queue->stop, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&queue->work);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->thread, NULL);
+    pthread_cond_destroy(&queue->done);
+    pthread_cond_destroy(&queue->work);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->cells);
+    free(queue);
+}
+
+bool strings_queue_submit(struct strings_queue *queue,
+                          struct strings_request *request,
+                          const char *string, size_t len) {
+    request->string = string;
+    request->len = len;
+    request->id = 0;
+    request->done = 0;
+
+    struct cell *cell;
+    size_t position = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == position) {
+            if (__atomic_compare_exchange_n(&queue->head, &position,
+                                            position + 1, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if ((ptrdiff_t)(sequence - position) < 0) {
+            return false;
+        } else {
+            position = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        }
+    }
+    cell->request = request;
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&queue->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_signal(&queue->work);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return true;
+}
+
+bool strings_queue_done(const struct strings_request *request) {
+    return __atomic_load_n(&request->done, __ATOMIC_ACQUIRE);
+}
+
+uint32_t strings_queue_wait(struct strings_queue *queue,
+                            struct strings_request *request) {
+    for (int i = 0; i < spin_limit; i++) {
+        if (strings_queue_done(request)) {
+            return request->id;
+        }
+        sched_yield();
+    }
+    pthread_mutex_lock(&queue->lock);
+    __atomic_add_fetch(&queue->waiters, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&request->done, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&queue->done, &queue->lock);
+    }
+    __atomic_sub_fetch(&queue->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&queue->lock);
+    return request->id;
+}
+
+uint32_t strings_queue_intern(struct strings_queue *queue, const char *string,
+                              size_t len) {
+    struct strings_request request;
+    while (!strings_queue_submit(queue, &request, string, len)) {
+        sched_yield();
+    }
+    return strings_queue_wait(queue, &request);
+}
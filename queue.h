@@ -0,0 +1,50 @@
+#ifndef INTERN_QUEUE_H_
+#define INTERN_QUEUE_H_
+
+#include "strings.h"
+
+// An ingestion queue which lets many threads intern strings into a single
+// repository. Producers add requests to a lock-free ring, and a dedicated
+// thread drains them in batches with strings_intern_batch(), so IDs stay
+// dense and in insertion order while producers never contend on a lock
+struct strings_queue;
+
+// A request to intern a string. The request (and the string) must remain
+// valid until the request is complete, at which point id is set to the
+// string's ID, or to 0 if an error occurred
+struct strings_request {
+    const char *string;
+    size_t len;
+    uint32_t id;
+    int done;
+};
+
+// Create a queue with room for the specified number of requests, which is
+// rounded up to a power of two, and start its interning thread. The queue
+// is the only writer to the repository until it is freed, though other
+// threads can read from the repository concurrently (see strings.h). This
+// function returns NULL if an error occurred
+struct strings_queue *strings_queue_new(struct strings*, size_t capacity);
+
+// Complete all outstanding requests, stop the interning thread and free
+// the queue. The repository is not freed
+void strings_queue_free(struct strings_queue*);
+
+// Initialize a request and add it to the queue. This function returns
+// false if the queue is full
+bool strings_queue_submit(struct strings_queue*, struct strings_request*,
+                          const char *string, size_t len);
+
+// Check whether a request is complete
+bool strings_queue_done(const struct strings_request*);
+
+// Wait for a request to complete and get the string's ID, or 0 if an error
+// occurred. Waiting threads spin briefly and then sleep until the batch
+// containing the request has been interned
+uint32_t strings_queue_wait(struct strings_queue*, struct strings_request*);
+
+// Intern a string through the queue and wait for its ID
+uint32_t strings_queue_intern(struct strings_queue*, const char *string,
+                              size_t len);
+
+#endif
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "sharded.h"
+#include "hash.h"
+#include "inline.h"
+
+#ifdef INLINE_UNSIGNED
+const static uint64_t id_limit = 0x80000000;
+#else
+const static uint64_t id_limit = 0x100000000;
+#endif
+
+// The maximum number of shards. Each shard costs at least a few pages
+static const size_t max_shards = 1024;
+
+// Shards are selected with a hash that is independent of the one the shard
+// itself uses
+static const uint64_t shard_seed = 0x9E3779B97F4A7C15ULL;
+
+// Shards are padded to a cache line so that threads holding locks on
+// neighbouring shards don't contend
+#define CACHE_LINE 64
+
+struct shard {
+    pthread_mutex_t lock;
+    struct strings *strings;
+    char padding[CACHE_LINE -
+                 (sizeof(pthread_mutex_t) + sizeof(void *)) % CACHE_LINE];
+};
+
+struct strings_sharded {
+    struct shard *shards;
+    size_t shard_count;
+    unsigned shard_bits;
+#ifdef INLINE_UNSIGNED
+    char buffer[11];
+#endif
+};
+
+struct strings_sharded *strings_sharded_new(size_t shards) {
+    if (!shards || shards > max_shards) {
+        return NULL;
+    }
+    struct strings_sharded *sharded = malloc(sizeof(*sharded));
+    if (!sharded) {
+        return NULL;
+    }
+    sharded->shard_bits = 0;
+    while ((size_t)1 << sharded->shard_bits < shards) {
+        sharded->shard_bits++;
+    }
+    sharded->shard_count = 0;
+    if (posix_memalign((void **)&sharded->shards, CACHE_LINE,
+                       sizeof(struct shard) << sharded->shard_bits)) {
+        free(sharded);
+        return NULL;
+    }
+    for (size_t i = 0; i < (size_t)1 << sharded->shard_bits; i++) {
+        struct shard *shard = &sharded->shards[i];
+        shard->strings = strings_new();
+        if (!shard->strings) {
+            goto error;
+        }
+        if (pthread_mutex_init(&shard->lock, NULL)) {
+            strings_free(shard->strings);
+            goto error;
+        }
+        sharded->shard_count++;
+    }
+    return sharded;
+
+error:
+    strings_sharded_free(sharded);
+    return NULL;
+}
+
+void strings_sharded_free(struct strings_sharded *sharded) {
+    for (size_t i = 0; i < sharded->shard_count; i++) {
+        pthread_mutex_destroy(&sharded->shards[i].lock);
+        strings_free(sharded->shards[i].strings);
+    }
+    free(sharded->shards);
+    free(sharded);
+}
+
+uint32_t strings_sharded_count(const struct strings_sharded *sharded) {
+    uint32_t count = 0;
+    for (size_t i = 0; i < sharded->shard_count; i++) {
+        count += strings_count(sharded->shards[i].strings);
+    }
+    return count;
+}
+
+static inline size_t shard_index(const struct strings_sharded *sharded,
+                                 const char *string, size_t len) {
+    uint64_t hash = hash_string(string, len, shard_seed);
+    return hash & (sharded->shard_count - 1);
+}
+
+// Combine a shard index with an ID from the shard, or return 0 if the ID
+// doesn't fit
+static inline uint32_t shard_id(const struct strings_sharded *sharded,
+                                size_t shard, uint32_t id) {
+#ifdef INLINE_UNSIGNED
+    if (id & unsigned_tag) {
+        return id;
+    }
+#endif
+    uint64_t combined = ((uint64_t)id << sharded->shard_bits) | shard;
+    return combined < id_limit ? (uint32_t)combined : 0;
+}
+
+uint32_t strings_sharded_intern(struct strings_sharded *sharded,
+                                const char *string) {
+    return strings_sharded_intern_len(sharded, string, strlen(string));
+}
+
+uint32_t strings_sharded_intern_len(struct strings_sharded *sharded,
+                                    const char *string, size_t len) {
+    size_t index = shard_index(sharded, string, len);
+    struct shard *shard = &sharded->shards[index];
+    pthread_mutex_lock(&shard->lock);
+    uint32_t id = strings_intern_len(shard->strings, string, len);
+    pthread_mutex_unlock(&shard->lock);
+    return id ? shard_id(sharded, index, id) : 0;
+}
+
+uint32_t strings_sharded_lookup(struct strings_sharded *sharded,
+                                const char *string) {
+    return strings_sharded_lookup_len(sharded, string, strlen(string));
+}
+
+uint32_t strings_sharded_lookup_len(struct strings_sharded *sharded,
+                                    const char *string, size_t len) {
+    size_t index = shard_index(sharded, string, len);
+    struct shard *shard = &sharded->shards[index];
+    pthread_mutex_lock(&shard->lock);
+    uint32_t id = strings_lookup_len(shard->strings, string, len);
+    pthread_mutex_unlock(&shard->lock);
+    return id ? shard_id(sharded, index, id) : 0;
+}
+
+// Strings are resolved by ID without taking the shard's lock. This is safe
+// while the shard's writer is interning strings, since it only reads
+// published entries of the append-only blocks and never touches the index
+const char *strings_sharded_lookup_id(struct strings_sharded *sharded,
+                                      uint32_t id) {
+#ifdef INLINE_UNSIGNED
+    if (id & unsigned_tag) {
+        unsigned_string(sharded->buffer, id & ~unsigned_tag);
+        return sharded->buffer;
+    }
+#endif
+    size_t index = id & (sharded->shard_count - 1);
+    uint32_t shard_local_id = id >> sharded->shard_bits;
+    return strings_lookup_id(sharded->shards[index].strings, shard_local_id);
+}
+
+size_t strings_sharded_allocated_bytes(struct strings_sharded *sharded) {
+    size_t bytes = sizeof(*sharded) +
+        sizeof(struct shard) * sharded->shard_count;
+    for (size_t i = 0; i < sharded->shard_count; i++) {
+        struct shard *shard = &sharded->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        bytes += strings_allocated_bytes(shard->strings);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return bytes;
+}
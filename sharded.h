@@ -0,0 +1,47 @@
+#ifndef INTERN_SHARDED_H_
+#define INTERN_SHARDED_H_
+
+#include "strings.h"
+
+struct strings_sharded;
+
+// Create a new sharded repository of strings, which can be used by many
+// threads at once. Strings are partitioned by hash into a number of
+// independent shards, each with its own lock, so that threads interning
+// different strings rarely contend. The number of shards is rounded up to a
+// power of two, and should be at least the number of interning threads.
+// This function returns NULL if an error occurred
+struct strings_sharded *strings_sharded_new(size_t shards);
+
+// Free a sharded repository
+void strings_sharded_free(struct strings_sharded*);
+
+// Count the number of unique strings in the repository
+uint32_t strings_sharded_count(const struct strings_sharded*);
+
+// Intern a string and get back a unique ID. The shard is encoded in the
+// low bits of the ID, so IDs are unique but are neither dense nor ordered.
+// This function returns 0 if an error occurred, or if the shard is full
+uint32_t strings_sharded_intern(struct strings_sharded*, const char *string);
+
+// Intern a string of the specified length
+uint32_t strings_sharded_intern_len(struct strings_sharded*,
+                                    const char *string, size_t len);
+
+// Lookup the ID for a string. This function returns zero if the string
+// does not exist in the repository
+uint32_t strings_sharded_lookup(struct strings_sharded*, const char *string);
+
+// Lookup the ID for a string of the specified length
+uint32_t strings_sharded_lookup_len(struct strings_sharded*,
+                                    const char *string, size_t len);
+
+// Lookup the string associated with an ID. This function does not take a
+// lock. As with strings_lookup_id(), inlined unsigned integers are written
+// into an internal buffer, which is not safe to share between threads
+const char *strings_sharded_lookup_id(struct strings_sharded*, uint32_t id);
+
+// Get the total bytes allocated, including overhead
+size_t strings_sharded_allocated_bytes(struct strings_sharded*);
+
+#endif
@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "shared.h"
+#include "hash.h"
+#include "table.h"
+
+static const uint64_t shared_magic = 0x31304853544E4900ULL;
+static const uint32_t shared_version = 2;
+
+// The region starts with this header, followed by the control bytes, the
+// slots, the string offsets (indexed by ID) and the string data, each
+// aligned to a page. The magic number is written last, so that a reader
+// which opens the region while it's being created rejects it. Only the
+// count and the number of bytes used change after creation. The table
+// can't be rebuilt while other processes are reading it, so strings are
+// always hashed with SipHash and a random key, rather than switching to it
+// when the repository is flooded
+struct shared_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t max_strings;
+    uint64_t size;
+    uint64_t group_mask;
+    uint64_t hash_key[2];
+    uint64_t slots_offset;
+    uint64_t refs_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t strings_used;
+    uint32_t count;
+};
+
+// Slots hold the high 32 bits of the hash, and the ID of the string. The
+// string is found through the offsets section, so slots need no pointers
+struct shared_slot {
+    uint32_t hash;
+    uint32_t id;
+};
+
+struct strings_shared {
+    struct shared_header *header;
+    uint8_t *ctrl;
+    struct shared_slot *slots;
+    uint64_t *refs;
+    char *strings;
+    size_t size;
+    bool writable;
+};
+
+static size_t shared_align(size_t size) {
+    return (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+}
+
+// Get the number of groups needed to hold a number of strings, leaving the
+// same headroom as a regular repository's table
+static size_t shared_groups(size_t count) {
+    size_t groups = 1;
+    while (groups * GROUP_WIDTH - groups * GROUP_WIDTH / 8 <= count) {
+        groups *= 2;
+    }
+    return groups;
+}
+
+static inline const char *shared_string(const struct strings_shared *shared,
+                                        uint32_t id) {
+    return shared->strings + shared->refs[id - 1] + sizeof(string_header_t);
+}
+
+static struct strings_shared *shared_map(int fd, size_t size, bool writable) {
+    struct strings_shared *shared = malloc(sizeof(*shared));
+    if (!shared) {
+        return NULL;
+    }
+    int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *region = mmap(NULL, size, protection, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+        free(shared);
+        return NULL;
+    }
+    shared->header = region;
+    shared->size = size;
+    shared->writable = writable;
+    return shared;
+}
+
+// Set the section pointers from the header
+static void shared_sections(struct strings_shared *shared) {
+    char *region = (char *)shared->header;
+    shared->ctrl = (uint8_t *)region + shared_align(sizeof(*shared->header));
+    shared->slots = (struct shared_slot *)(region +
+                                           shared->header->slots_offset);
+    shared->refs = (uint64_t *)(region + shared->header->refs_offset);
+    shared->strings = region + shared->header->strings_offset;
+}
+
+struct strings_shared *strings_shared_create(const char *name,
+                                             uint32_t max_strings,
+                                             size_t max_bytes) {
+    uint64_t key[2];
+    if (!max_strings || max_strings == UINT32_MAX || !random_key(key)) {
+        return NULL;
+    }
+    size_t groups = shared_groups(max_strings);
+    size_t capacity = groups * GROUP_WIDTH;
+    size_t ctrl_offset = shared_align(sizeof(struct shared_header));
+    size_t slots_offset = ctrl_offset + shared_align(capacity);
+    size_t refs_offset = slots_offset +
+        shared_align(capacity * sizeof(struct shared_slot));
+    size_t strings_offset = refs_offset +
+        shared_align((size_t)max_strings * sizeof(uint64_t));
+    size_t size = strings_offset + shared_align(max_bytes);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct strings_shared *shared = NULL;
+    if (!ftruncate(fd, size)) {
+        shared = shared_map(fd, size, true);
+    }
+    close(fd);
+    if (!shared) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The object is zero-filled, so only the control bytes and the header
+    // need to be written. Untouched pages use no memory
+    struct shared_header *header = shared->header;
+    header->version = shared_version;
+    header->size = size;
+    header->group_mask = groups - 1;
+    header->hash_key[0] = key[0];
+    header->hash_key[1] = key[1];
+    header->slots_offset = slots_offset;
+    header->refs_offset = refs_offset;
+    header->strings_offset = strings_offset;
+    header->strings_size = max_bytes;
+    header->strings_used = 0;
+    header->max_strings = max_strings;
+    header->count = 0;
+    shared_sections(shared);
+    memset(shared->ctrl, ctrl_empty, capacity);
+    store_release(&header->magic, shared_magic);
+    return shared;
+}
+
+static bool valid_header(const struct shared_header *header, size_t size) {
+    if (load_acquire(&header->magic) != shared_magic ||
+            header->version != shared_version || header->size != size) {
+        return false;
+    }
+    size_t groups = header->group_mask + 1;
+    size_t capacity = groups * GROUP_WIDTH;
+    size_t ctrl_offset = shared_align(sizeof(*header));
+    return groups && !(groups & header->group_mask) &&
+        header->max_strings < capacity &&
+        header->slots_offset >= ctrl_offset + capacity &&
+        header->refs_offset >= header->slots_offset +
+            capacity * sizeof(struct shared_slot) &&
+        header->strings_offset >= header->refs_offset +
+            (size_t)header->max_strings * sizeof(uint64_t) &&
+        header->strings_offset <= size &&
+        header->strings_size <= size - header->strings_offset;
+}
+
+struct strings_shared *strings_shared_open(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    struct strings_shared *shared = NULL;
+    if (!fstat(fd, &info) &&
+            (size_t)info.st_size >= sizeof(struct shared_header)) {
+        shared = shared_map(fd, info.st_size, false);
+    }
+    close(fd);
+    if (!shared) {
+        return NULL;
+    }
+    if (!valid_header(shared->header, shared->size)) {
+        strings_shared_close(shared);
+        return NULL;
+    }
+    shared_sections(shared);
+    return shared;
+}
+
+void strings_shared_close(struct strings_shared *shared) {
+    munmap(shared->header, shared->size);
+    free(shared);
+}
+
+bool strings_shared_unlink(const char *name) {
+    return !shm_unlink(name);
+}
+
+uint32_t strings_shared_count(const struct strings_shared *shared) {
+    return load_acquire(&shared->header->count);
+}
+
+static inline uint32_t shared_hash(const struct strings_shared *shared,
+                                   const char *string, size_t len) {
+    return slot_hash(hash_string_keyed(string, len,
+                                       shared->header->hash_key));
+}
+
+// The string a shared repository is being probed for
+struct shared_probe {
+    const struct strings_shared *shared;
+    uint32_t hash;
+    const char *string;
+    size_t len;
+};
+
+static inline bool shared_found(const void *context, size_t index) {
+    const struct shared_probe *probe = context;
+    const struct shared_slot *slot = &probe->shared->slots[index];
+    if (slot->hash != probe->hash) {
+        return false;
+    }
+    const char *candidate = shared_string(probe->shared, slot->id);
+    return stored_length(candidate) == probe->len &&
+        !memcmp(candidate, probe->string, probe->len);
+}
+
+// Find the slot for a string. The writer publishes each control byte after
+// its slot, and the string's offset before either, so any slot with a
+// matching control byte can be read
+static const struct shared_slot *shared_find(
+        const struct strings_shared *shared, uint32_t hash,
+        const char *string, size_t len) {
+    struct shared_probe probe = {shared, hash, string, len};
+    size_t index = probe_find(shared->ctrl, shared->header->group_mask, hash,
+                              shared_found, &probe);
+    return index == SIZE_MAX ? NULL : &shared->slots[index];
+}
+
+uint32_t strings_shared_intern_len(struct strings_shared *shared,
+                                   const char *string, size_t len) {
+    if (!shared->writable) {
+        return 0;
+    }
+    struct shared_header *header = shared->header;
+    uint32_t hash = shared_hash(shared, string, len);
+    const struct shared_slot *existing = shared_find(shared, hash, string,
+                                                     len);
+    if (existing) {
+        return existing->id;
+    }
+    string_header_t string_header = len;
+    size_t bytes = sizeof(string_header) + len + 1;
+    if (header->count == header->max_strings || string_header != len ||
+            bytes > header->strings_size - header->strings_used) {
+        return 0;
+    }
+
+    // The table has room for max_strings, but a string whose probe would
+    // be too long is rejected rather than stored, since the table can't be
+    // rekeyed. With a random key this only happens by chance
+    size_t probes;
+    size_t index = probe_free(shared->ctrl, header->group_mask, hash,
+                              &probes);
+    if (probes > max_probes) {
+        return 0;
+    }
+
+    char *string_ptr = shared->strings + header->strings_used;
+    memcpy(string_ptr, &string_header, sizeof(string_header));
+    memcpy(string_ptr + sizeof(string_header), string, len);
+    string_ptr[sizeof(string_header) + len] = '\0';
+    uint32_t id = header->count + 1;
+    shared->refs[id - 1] = header->strings_used;
+    store_release(&header->strings_used, header->strings_used + bytes);
+    store_release(&header->count, id);
+
+    struct shared_slot slot = {hash, id};
+    shared->slots[index] = slot;
+    group_set_release(shared->ctrl + index / GROUP_WIDTH * GROUP_WIDTH,
+                      index % GROUP_WIDTH, slot_tag(hash));
+    return id;
+}
+
+uint32_t strings_shared_intern(struct strings_shared *shared,
+                               const char *string) {
+    return strings_shared_intern_len(shared, string, strlen(string));
+}
+
+uint32_t strings_shared_lookup_len(const struct strings_shared *shared,
+                                   const char *string, size_t len) {
+    uint32_t hash = shared_hash(shared, string, len);
+    const struct shared_slot *slot = shared_find(shared, hash, string, len);
+    return slot ? slot->id : 0;
+}
+
+uint32_t strings_shared_lookup(const struct strings_shared *shared,
+                               const char *string) {
+    return strings_shared_lookup_len(shared, string, strlen(string));
+}
+
+const char *strings_shared_lookup_id(const struct strings_shared *shared,
+                                     uint32_t id) {
+    if (!id || id > load_acquire(&shared->header->count)) {
+        return NULL;
+    }
+    return shared_string(shared, id);
+}
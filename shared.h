@@ -0,0 +1,70 @@
+#ifndef INTERN_SHARED_H_
+#define INTERN_SHARED_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A string repository which lives in a named POSIX shared memory object, so
+// that one process can intern strings while any number of other processes
+// look them up from the same physical pages. Everything in the region is
+// referred to by offset, so each process can map it at a different address.
+//
+// The region has a fixed capacity which is chosen when it's created, since
+// it can't be grown or moved while other processes have it mapped. Pages
+// are only backed by memory once they're written to, so the capacity can be
+// generous. There must only be one writer (the handle returned by
+// strings_shared_create(), used from one thread in one process, e.g. not
+// from both sides of a fork). Readers need no locks, and see strings as
+// soon as the writer has interned them
+//
+// Strings are hashed with a random key, which is chosen when the repository
+// is created, so that they can't be picked to collide in the table. Since
+// IDs are shared with processes which may be built with other options,
+// integers are never inlined into IDs, even with INLINE_UNSIGNED
+struct strings_shared;
+
+// Create a shared repository with room for the specified number of strings
+// and bytes of string data. The name must start with a slash and must not
+// already exist. This function returns NULL if an error occurred
+struct strings_shared *strings_shared_create(const char *name,
+                                             uint32_t max_strings,
+                                             size_t max_bytes);
+
+// Open an existing shared repository for reading. This function returns
+// NULL if the repository does not exist or is invalid
+struct strings_shared *strings_shared_open(const char *name);
+
+// Unmap a shared repository. The repository continues to exist until it is
+// unlinked and every process has closed it
+void strings_shared_close(struct strings_shared*);
+
+// Remove the name of a shared repository. This function returns true if
+// the name was removed
+bool strings_shared_unlink(const char *name);
+
+// Get the total number of unique strings
+uint32_t strings_shared_count(const struct strings_shared*);
+
+// Intern a string and get back its unique ID. IDs start at 1. This
+// function returns zero if the repository is full, if the handle was
+// opened for reading, or if an error occurred. It also returns zero in
+// the unlikely event that the string collides with so many others that
+// finding a slot for it would slow down lookups
+uint32_t strings_shared_intern(struct strings_shared*, const char *string);
+uint32_t strings_shared_intern_len(struct strings_shared*, const char *string,
+                                   size_t len);
+
+// Lookup the ID for a string. This function returns zero if the string
+// does not exist in the repository
+uint32_t strings_shared_lookup(const struct strings_shared*,
+                               const char *string);
+uint32_t strings_shared_lookup_len(const struct strings_shared*,
+                                   const char *string, size_t len);
+
+// Lookup the string associated with an ID. This function returns NULL if
+// the ID is invalid. Strings remain valid until the handle is closed
+const char *strings_shared_lookup_id(const struct strings_shared*,
+                                     uint32_t id);
+
+#endif
@@ -1,91 +1,515 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "strings.h"
-#include "tree.h"
-
-#ifdef INLINE_UNSIGNED
+#include "hash.h"
+#include "inline.h"
 #include "unsigned.h"
+#include "table.h"
 
-const static uint32_t unsigned_tag = 0x80000000;
-const static uint32_t id_overflow = 0x80000000;
+// The location of a string (its header) in the strings block
+struct string_ref {
+    uint32_t page;
+    uint32_t offset;
+};
 
-static int is_small_unsigned(const char *string) {
-    char c;
-    int numeric = 0;
-    const char *ptr = string;
-    while ((c = *ptr++)) {
-        if (c < '0' || c > '9' || numeric > 10) {
-            numeric = -1;
-            break;
-        }
-        numeric++;
-    }
-    return numeric >= 1 && \
-        (numeric < 10 || (numeric == 10 && string[0] <= '2'));
+static const size_t refs_per_page = PAGE_SIZE / sizeof(struct string_ref);
+
+static inline const struct string_ref *id_ref(const struct block *refs,
+                                             uint32_t id) {
+    size_t offset = (size_t)(id - 1);
+    void **pages = load_acquire(&refs->pages);
+    const void *page = pages[offset / refs_per_page];
+    return (const struct string_ref *)page + offset % refs_per_page;
 }
 
-static uint32_t to_unsigned(const char *string) {
-    uint32_t number = 0;
-    char c;
-    while ((c = *string++)) {
-        number = number * 10 + (c - '0');
-    }
-    return number;
+static inline const char *ref_string(const struct block *strings,
+                                     const struct string_ref *ref) {
+    const void *page = block_page(strings, ref->page);
+    return (const char *)((uintptr_t)page + ref->offset +
+                          sizeof(string_header_t));
 }
 
-#else
-const static uint32_t id_overflow = 0;
-#endif
+// Compare strings bytewise, with a string that's a prefix of another string
+// ordered first
+static inline int compare_strings(const char *a, size_t a_len,
+                                  const char *b, size_t b_len) {
+    int result = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (result) {
+        return result;
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
 
-typedef struct tree_node_s tree_node_t;
-struct tree_node_s {
+// Slots refer to strings by their location in the strings block rather
+// than by pointer, so that an index can be saved and mapped back in at a
+// different address. Strings of up to 15 bytes are instead stored in the
+// slot, after their length and padded with zeros, so that a match can be
+// confirmed by comparing 16 bytes without a second cache miss to read the
+// strings block. Longer strings have a length byte of long_key, and their
+// location is stored in the last 8 bytes
+struct slot {
     uint32_t hash;
     uint32_t id;
-    const char *string;
-    rb_node(tree_node_t) tree_link;
-    tree_node_t *next;
+    uint8_t key[16];
 };
 
-typedef rb_tree(tree_node_t) tree_t;
+static const size_t inline_key_max = 15;
+static const uint8_t long_key = 0xFF;
+static const size_t key_ref_offset = 8;
+
+// Build the key of a slot (or of a string being looked up, in which case
+// the ref of a long string isn't needed and can be NULL)
+static inline void slot_key(uint8_t *key, const char *string, size_t len,
+                            const struct string_ref *ref) {
+    memset(key, 0, sizeof(((struct slot *)0)->key));
+    if (len <= inline_key_max) {
+        key[0] = len;
+        memcpy(key + 1, string, len);
+    } else {
+        key[0] = long_key;
+        if (ref) {
+            memcpy(key + key_ref_offset, ref, sizeof(*ref));
+        }
+    }
+}
 
-static int tree_cmp(tree_node_t *a, tree_node_t *b) {
-    return a->hash < b->hash ? -1 : (a->hash > b->hash ? 1 : 0);
+static inline struct string_ref slot_ref(const struct slot *slot) {
+    struct string_ref ref;
+    memcpy(&ref, slot->key + key_ref_offset, sizeof(ref));
+    return ref;
 }
 
-rb_gen(static, tree_, tree_t, tree_node_t, tree_link, tree_cmp)
+// The number of strings which are hashed and prefetched together by the
+// batch functions
+#define BATCH_SIZE 16
+
+struct table {
+    uint8_t *ctrl;
+    struct slot *slots;
+    size_t group_mask;
+    size_t growth_left;
+    // Each table holds the hash parameters it was built with, so that
+    // readers hash strings the same way as the table they loaded, even if
+    // the writer rekeys the repository concurrently
+    uint64_t hash_seed;
+    uint64_t hash_key[2];
+    bool keyed;
+    // Whether the control bytes and slots are in a mapped file
+    bool mapped;
+    // Replaced tables are retired until no reader can still be using them
+    uint64_t retired_epoch;
+    struct table *retired_next;
+};
+
+struct strings_reader {
+    struct strings *strings;
+    uint64_t epoch;
+    bool in_use;
+    struct strings_reader *next;
+};
+
+// Versions are registered like readers. The writer checks their totals
+// before removing strings, and a version's total is zero while it's unused
+struct strings_version {
+    struct strings *strings;
+    uint32_t total;
+    bool in_use;
+    struct strings_version *next;
+};
 
+// There is a single writer, which is the thread calling functions that take
+// a non-const repository. Readers load the table pointers with acquire
+// semantics, and tables that have been replaced are reclaimed once every
+// active reader has entered an epoch after they were retired
 struct strings {
     struct block *hashes;
     struct block *strings;
-    struct block *index;
-    tree_t hash_map;
+    struct block *refs;
+    struct table *table;
+    struct table *old_table;
+    size_t migrate_group;
     uint32_t total;
-    uint32_t hash_seed;
+    // The number of strings which can also be found in the table, which
+    // lags behind the total while a string is being inserted
+    uint32_t indexed;
+    // The number of strings, starting from ID 1, which are in order
+    uint32_t sorted;
+    uint32_t rehashes;
+    uint32_t generation;
+    uint64_t epoch;
+    struct strings_reader *readers;
+    struct strings_version *versions;
+    struct table *retired;
+    void *mapping;
+    size_t mapping_size;
 #ifdef INLINE_UNSIGNED
     char buffer[11];
 #endif
+    // Strings inlined into 64-bit IDs are decoded here
+    char buffer64[21];
 };
 
-struct strings *strings_new() {
+// Allocate a table, taking its hash parameters from another table if
+// params is not NULL
+static struct table *table_new(size_t groups, const struct table *params) {
+    struct table *table = malloc(sizeof(*table));
+    if (!table) {
+        return NULL;
+    }
+    size_t capacity = groups * GROUP_WIDTH;
+    table->ctrl = malloc(capacity);
+    table->slots = malloc(capacity * sizeof(*table->slots));
+    if (!table->ctrl || !table->slots) {
+        free(table->ctrl);
+        free(table->slots);
+        free(table);
+        return NULL;
+    }
+    memset(table->ctrl, ctrl_empty, capacity);
+    table->group_mask = groups - 1;
+    table->growth_left = capacity - capacity / 8;
+    table->mapped = false;
+    if (params) {
+        table->hash_seed = params->hash_seed;
+        table->hash_key[0] = params->hash_key[0];
+        table->hash_key[1] = params->hash_key[1];
+        table->keyed = params->keyed;
+    } else {
+        table->hash_seed = 5381;
+        table->keyed = false;
+    }
+    return table;
+}
+
+static void table_free(struct table *table) {
+    if (table) {
+        if (!table->mapped) {
+            free(table->ctrl);
+            free(table->slots);
+        }
+        free(table);
+    }
+}
+
+static size_t table_bytes(const struct table *table) {
+    if (!table) {
+        return 0;
+    }
+    size_t capacity = (table->group_mask + 1) * GROUP_WIDTH;
+    return capacity * (1 + sizeof(*table->slots)) + sizeof(*table);
+}
+
+static inline uint64_t table_hash(const struct table *table,
+                                  const char *string, size_t len) {
+    if (table->keyed) {
+        return hash_string_keyed(string, len, table->hash_key);
+    }
+    return hash_string(string, len, table->hash_seed);
+}
+
+static inline bool same_hash(const struct table *a, const struct table *b) {
+    if (a->keyed != b->keyed) {
+        return false;
+    }
+    if (a->keyed) {
+        return a->hash_key[0] == b->hash_key[0] &&
+            a->hash_key[1] == b->hash_key[1];
+    }
+    return a->hash_seed == b->hash_seed;
+}
+
+// The string a table is being probed for, and the key of its slots
+struct table_probe {
+    const struct table *table;
+    const struct block *strings;
+    uint32_t hash;
+    const char *string;
+    size_t len;
+    uint8_t key[sizeof(((struct slot *)0)->key)];
+};
+
+static inline bool table_found(const void *context, size_t index) {
+    const struct table_probe *probe = context;
+    const struct slot *slot = &probe->table->slots[index];
+    if (slot->hash != probe->hash) {
+        return false;
+    }
+    if (probe->len <= inline_key_max) {
+        return !memcmp(slot->key, probe->key, sizeof(probe->key));
+    }
+    if (slot->key[0] != long_key) {
+        return false;
+    }
+    struct string_ref ref = slot_ref(slot);
+    const char *candidate = ref_string(probe->strings, &ref);
+    return stored_length(candidate) == probe->len &&
+        !memcmp(candidate, probe->string, probe->len);
+}
+
+static const struct slot *table_find(const struct table *table,
+                                     const struct block *strings,
+                                     uint32_t hash, const char *string,
+                                     size_t len) {
+    struct table_probe probe = {table, strings, hash, string, len, {0}};
+    slot_key(probe.key, string, len, NULL);
+    size_t index = probe_find(table->ctrl, table->group_mask, hash,
+                              table_found, &probe);
+    return index == SIZE_MAX ? NULL : &table->slots[index];
+}
+
+// Insert a slot into a free position. The caller must have checked that the
+// string is not already present, and that the table has room to grow. The
+// slot is written before its control byte is published, so that readers
+// never see a partially written slot. The number of groups that had to be
+// probed is written to probes
+static void table_insert(struct table *table, const struct slot *slot,
+                         size_t *probes) {
+    size_t index = probe_free(table->ctrl, table->group_mask, slot->hash,
+                              probes);
+    if (table->ctrl[index] == ctrl_empty) {
+        table->growth_left--;
+    }
+    table->slots[index] = *slot;
+    group_set_release(table->ctrl + index / GROUP_WIDTH * GROUP_WIDTH,
+                      index % GROUP_WIDTH, slot_tag(slot->hash));
+}
+
+// Remove the slot with an ID from a table. The control byte is set to
+// empty if the group has an empty slot already, since then no probe can
+// have continued past the group, and otherwise it's set to deleted so that
+// probes still continue past it
+static void table_remove(struct table *table, uint32_t hash, uint32_t id) {
+    uint8_t tag = slot_tag(hash);
+    size_t group = hash & table->group_mask;
+    for (size_t stride = 1;; stride++) {
+        uint8_t *ctrl = table->ctrl + group * GROUP_WIDTH;
+        uint64_t bytes = group_load(ctrl);
+        uint64_t match = group_match(bytes, tag);
+        for (; match; match &= match - 1) {
+            size_t index = group_mask_index(match);
+            const struct slot *slot = &table->slots[group * GROUP_WIDTH +
+                                                    index];
+            if (slot->hash != hash || slot->id != id) {
+                continue;
+            }
+            if (group_match_empty(bytes)) {
+                group_set_release(ctrl, index, ctrl_empty);
+                table->growth_left++;
+            } else {
+                group_set_release(ctrl, index, ctrl_deleted);
+            }
+            return;
+        }
+        if (group_match_empty(bytes) || stride > table->group_mask) {
+            return;
+        }
+        group = (group + stride) & table->group_mask;
+    }
+}
+
+// Copy full slots from a range of groups in one table into another,
+// skipping strings with an ID beyond max_id
+static void table_copy(struct table *dest, const struct table *src,
+                       size_t first_group, size_t last_group, uint32_t max_id) {
+    size_t probes;
+    for (size_t group = first_group; group <= last_group; group++) {
+        uint64_t ctrl = group_load(src->ctrl + group * GROUP_WIDTH);
+        uint64_t full = group_match_full(ctrl);
+        for (; full; full &= full - 1) {
+            size_t index = group * GROUP_WIDTH + group_mask_index(full);
+            const struct slot *slot = &src->slots[index];
+            if (slot->id <= max_id) {
+                table_insert(dest, slot, &probes);
+            }
+        }
+    }
+}
+
+// Insert many slots into an empty table. Inserting slots in a random order
+// misses the cache on almost every slot once the table is larger than the
+// cache, so slots are first bucketed by the range of groups they start
+// probing from, with a counting sort, and then inserted range by range.
+// This function returns false if an error occurred
+static bool table_insert_bulk(struct table *table, const struct slot *slots,
+                              size_t n) {
+    size_t groups = table->group_mask + 1;
+    size_t buckets = groups < 65536 ? groups : 65536;
+    size_t shift = 0;
+    while (groups >> shift > buckets) {
+        shift++;
+    }
+    struct slot *sorted = malloc(sizeof(*sorted) * (n ? n : 1));
+    size_t *offsets = calloc(buckets, sizeof(*offsets));
+    if (!sorted || !offsets) {
+        free(sorted);
+        free(offsets);
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        offsets[(slots[i].hash & table->group_mask) >> shift]++;
+    }
+    size_t offset = 0;
+    for (size_t bucket = 0; bucket < buckets; bucket++) {
+        size_t bucket_count = offsets[bucket];
+        offsets[bucket] = offset;
+        offset += bucket_count;
+    }
+    for (size_t i = 0; i < n; i++) {
+        sorted[offsets[(slots[i].hash & table->group_mask) >> shift]++] =
+            slots[i];
+    }
+    size_t probes;
+    for (size_t i = 0; i < n; i++) {
+        table_insert(table, &sorted[i], &probes);
+    }
+    free(sorted);
+    free(offsets);
+    return true;
+}
+
+// Free retired tables which no reader can be using. A reader that entered
+// before a table was retired may have loaded it, so tables are only freed
+// once they were retired in an epoch older than that of every active reader
+static void reclaim_tables(struct strings *strings) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t oldest = UINT64_MAX;
+    const struct strings_reader *reader = load_acquire(&strings->readers);
+    for (; reader; reader = reader->next) {
+        uint64_t epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+        if (epoch && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    struct table **link = &strings->retired;
+    while (*link) {
+        struct table *table = *link;
+        if (table->retired_epoch < oldest) {
+            *link = table->retired_next;
+            table_free(table);
+        } else {
+            link = &table->retired_next;
+        }
+    }
+}
+
+// Retire a table which has been unpublished, and start a new epoch
+static void retire_table(struct strings *strings, struct table *table) {
+    if (!table) {
+        return;
+    }
+    table->retired_epoch = strings->epoch;
+    table->retired_next = strings->retired;
+    strings->retired = table;
+    __atomic_store_n(&strings->epoch, strings->epoch + 1, __ATOMIC_SEQ_CST);
+    reclaim_tables(strings);
+}
+
+// Replace both tables, e.g. after a rehash or a restore
+static void replace_tables(struct strings *strings, struct table *table) {
+    struct table *old_table = strings->old_table;
+    struct table *replaced = strings->table;
+    store_release(&strings->table, table);
+    store_release(&strings->old_table, NULL);
+    retire_table(strings, old_table);
+    retire_table(strings, replaced);
+}
+
+// Move one group of slots from the old table into the new one. This is
+// called on each insertion while the table is growing so that the cost of
+// a resize is spread out rather than paid by a single call. The old table
+// is twice as small as the new table and so it is fully migrated well
+// before the new table runs out of room
+static void migrate_group(struct strings *strings) {
+    struct table *old_table = strings->old_table;
+    size_t group = strings->migrate_group++;
+    table_copy(strings->table, old_table, group, group, UINT32_MAX);
+    if (strings->migrate_group > old_table->group_mask) {
+        store_release(&strings->old_table, NULL);
+        retire_table(strings, old_table);
+    }
+}
+
+// Get the number of groups needed to hold a number of strings
+static size_t table_groups(size_t count) {
+    size_t groups = 1;
+    while (groups * GROUP_WIDTH - groups * GROUP_WIDTH / 8 <= count) {
+        groups *= 2;
+    }
+    return groups;
+}
+
+__attribute__ ((noinline))
+static bool grow_table(struct strings *strings) {
+    while (strings->old_table) {
+        migrate_group(strings);
+    }
+    if (strings->table->growth_left) {
+        return true;
+    }
+    // Restores leave deleted slots behind, which use up room in the table.
+    // If at least half of the room went to them, the table is rebuilt at
+    // the same size to clear them rather than grown
+    size_t groups = strings->table->group_mask + 1;
+    size_t capacity = groups * GROUP_WIDTH;
+    if (strings->total < (capacity - capacity / 8) / 2) {
+        struct table *table = table_new(groups, strings->table);
+        if (!table) {
+            return false;
+        }
+        table_copy(table, strings->table, 0, strings->table->group_mask,
+                   UINT32_MAX);
+        replace_tables(strings, table);
+        return true;
+    }
+    struct table *table = table_new(groups * 2, strings->table);
+    if (!table) {
+        return false;
+    }
+    // Readers load the table and then the old table, so the old table is
+    // published first to ensure that readers see every string
+    store_release(&strings->old_table, strings->table);
+    store_release(&strings->table, table);
+    strings->migrate_group = 0;
+    return true;
+}
+
+// Create a repository around a strings block, which may be file-backed
+static struct strings *strings_create(struct block *strings_block) {
     struct strings *strings = malloc(sizeof(*strings));
     if (!strings) {
+        if (strings_block) {
+            block_free(strings_block);
+        }
         return NULL;
     }
 
     strings->hashes = block_new(PAGE_SIZE);
-    strings->strings = block_new(PAGE_SIZE);
-    strings->index = block_new(PAGE_SIZE);
-    if (!strings->hashes || !strings->strings || !strings->index) {
+    strings->strings = strings_block;
+    strings->refs = block_new(PAGE_SIZE);
+    strings->table = table_new(1, NULL);
+    if (!strings->hashes || !strings->strings || !strings->refs ||
+            !strings->table) {
         goto error;
     }
-
-    tree_new(&strings->hash_map);
+    strings->old_table = NULL;
 
     strings->total = 0;
-    strings->hash_seed = 5381;
+    strings->indexed = 0;
+    strings->sorted = 0;
+    strings->rehashes = 0;
+    strings->generation = 0;
+    strings->epoch = 1;
+    strings->readers = NULL;
+    strings->versions = NULL;
+    strings->retired = NULL;
+    strings->mapping = NULL;
 
     return strings;
 
@@ -96,147 +520,683 @@ error:
     if (strings->strings) {
         block_free(strings->strings);
     }
-    if (strings->index) {
-        block_free(strings->index);
+    if (strings->refs) {
+        block_free(strings->refs);
     }
+    table_free(strings->table);
     free(strings);
     return NULL;
 }
 
+struct strings *strings_new() {
+    return strings_create(block_new(PAGE_SIZE));
+}
+
+struct strings *strings_new_file(int fd) {
+    return strings_create(block_new_file(PAGE_SIZE, fd));
+}
+
+// Check whether a pinned version has strings beyond a total
+static bool pinned_beyond(const struct strings *strings, uint32_t total) {
+    const struct strings_version *version = load_acquire(&strings->versions);
+    for (; version; version = version->next) {
+        if (__atomic_load_n(&version->total, __ATOMIC_SEQ_CST) > total) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool strings_version_pinned(const struct strings *strings) {
+    const struct strings_version *version = load_acquire(&strings->versions);
+    for (; version; version = version->next) {
+        if (load_acquire(&version->in_use)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool strings_compress(struct strings *strings, size_t cache_pages) {
+    // strings_decode_column() holds on to the strings of a batch of
+    // BATCH_SIZE IDs until it copies them out. Each string's page is the
+    // most recently used when it's resolved, and at most BATCH_SIZE - 1
+    // other pages are decompressed before it's copied, so the batch stays
+    // cached as long as the cache has at least BATCH_SIZE pages
+    if (cache_pages < BATCH_SIZE || strings_version_pinned(strings)) {
+        return false;
+    }
+    return block_compress(strings->strings, cache_pages);
+}
+
+bool strings_compressed(const struct strings *strings) {
+    return strings->strings->compression != NULL;
+}
+
+size_t strings_compressed_pages(const struct strings *strings) {
+    return block_compressed_pages(strings->strings);
+}
+
 void strings_free(struct strings *strings) {
     block_free(strings->hashes);
     block_free(strings->strings);
-    block_free(strings->index);
+    block_free(strings->refs);
+    table_free(strings->table);
+    table_free(strings->old_table);
+    while (strings->retired) {
+        struct table *table = strings->retired;
+        strings->retired = table->retired_next;
+        table_free(table);
+    }
+    while (strings->readers) {
+        struct strings_reader *reader = strings->readers;
+        strings->readers = reader->next;
+        free(reader);
+    }
+    while (strings->versions) {
+        struct strings_version *version = strings->versions;
+        strings->versions = version->next;
+        free(version);
+    }
+    if (strings->mapping) {
+        munmap(strings->mapping, strings->mapping_size);
+    }
     free(strings);
 }
 
-static uint32_t strings_hash(const struct strings *strings,
-                             const char *string) {
-    uint32_t hash = strings->hash_seed;
-    char c;
-    while ((c = *string++)) {
-        hash = ((hash << 5) + hash) + (uint32_t)c;
+struct strings_reader *strings_reader_new(struct strings *strings) {
+    struct strings_reader *reader = load_acquire(&strings->readers);
+    for (; reader; reader = reader->next) {
+        bool in_use = false;
+        if (__atomic_compare_exchange_n(&reader->in_use, &in_use, true, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return reader;
+        }
+    }
+    reader = malloc(sizeof(*reader));
+    if (!reader) {
+        return NULL;
+    }
+    reader->strings = strings;
+    reader->epoch = 0;
+    reader->in_use = true;
+    reader->next = load_acquire(&strings->readers);
+    while (!__atomic_compare_exchange_n(&strings->readers, &reader->next,
+                                        reader, true, __ATOMIC_RELEASE,
+                                        __ATOMIC_ACQUIRE)) {}
+    return reader;
+}
+
+void strings_reader_free(struct strings_reader *reader) {
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_SEQ_CST);
+    store_release(&reader->in_use, false);
+}
+
+void strings_reader_enter(struct strings_reader *reader) {
+    uint64_t epoch = __atomic_load_n(&reader->strings->epoch,
+                                     __ATOMIC_SEQ_CST);
+    __atomic_store_n(&reader->epoch, epoch, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void strings_reader_exit(struct strings_reader *reader) {
+    store_release(&reader->epoch, 0);
+}
+
+struct strings_version *strings_version_pin(struct strings *strings) {
+    if (strings_compressed(strings)) {
+        return NULL;
+    }
+    struct strings_version *version = load_acquire(&strings->versions);
+    for (; version; version = version->next) {
+        bool in_use = false;
+        if (__atomic_compare_exchange_n(&version->in_use, &in_use, true,
+                                        false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!version) {
+        version = malloc(sizeof(*version));
+        if (!version) {
+            return NULL;
+        }
+        version->strings = strings;
+        version->total = 0;
+        version->in_use = true;
+        version->next = load_acquire(&strings->versions);
+        while (!__atomic_compare_exchange_n(&strings->versions,
+                                            &version->next, version, true,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_ACQUIRE)) {}
+    }
+    // Versions only see strings that can be found in the table. The writer
+    // lowers the total before checking versions, and the version is
+    // published before the total is checked again, so either the writer
+    // sees the version or the version sees that strings were removed. The
+    // generation catches strings that were removed and then replaced
+    for (;;) {
+        uint32_t generation = __atomic_load_n(&strings->generation,
+                                              __ATOMIC_SEQ_CST);
+        uint32_t total = __atomic_load_n(&strings->indexed, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&version->total, total, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&strings->total, __ATOMIC_SEQ_CST) >= total &&
+                __atomic_load_n(&strings->generation,
+                                __ATOMIC_SEQ_CST) == generation) {
+            return version;
+        }
+    }
+}
+
+void strings_version_unpin(struct strings_version *version) {
+    __atomic_store_n(&version->total, 0, __ATOMIC_SEQ_CST);
+    store_release(&version->in_use, false);
+}
+
+uint32_t strings_version_count(const struct strings_version *version) {
+    return version->total;
+}
+
+// Check whether an ID from the repository is visible in a version. Inlined
+// IDs are in every version
+static inline bool version_has(const struct strings_version *version,
+                               uint32_t id) {
+    return id <= version->total || (id_overflow && id >= id_overflow);
+}
+
+uint32_t strings_version_lookup(const struct strings_version *version,
+                                const char *string) {
+    return strings_version_lookup_len(version, string, strlen(string));
+}
+
+uint32_t strings_version_lookup_len(const struct strings_version *version,
+                                    const char *string, size_t len) {
+    uint32_t id = strings_lookup_len(version->strings, string, len);
+    return version_has(version, id) ? id : 0;
+}
+
+const char *strings_version_lookup_id(const struct strings_version *version,
+                                      uint32_t id) {
+    size_t len;
+    return strings_version_lookup_id_len(version, id, &len);
+}
+
+const char *strings_version_lookup_id_len(
+        const struct strings_version *version, uint32_t id, size_t *len) {
+    if (!version_has(version, id)) {
+        return NULL;
+    }
+    return strings_lookup_id_len(version->strings, id, len);
+}
+
+// Switch to keyed hashing and rehash every string in the repository. The
+// new table is built on the side and then published, so that concurrent
+// readers keep using the old tables until they are done with them
+__attribute__ ((noinline))
+static bool rehash(struct strings *strings, const uint64_t key[2]) {
+    struct table *table = table_new(table_groups(strings->total), NULL);
+    if (!table) {
+        return false;
+    }
+    table->keyed = true;
+    table->hash_key[0] = key[0];
+    table->hash_key[1] = key[1];
+
+    size_t hashes_per_page = PAGE_SIZE / sizeof(uint64_t);
+    size_t probes;
+    for (uint32_t id = 1; id <= strings->total; id++) {
+        const struct string_ref *ref = id_ref(strings->refs, id);
+        const char *string = ref_string(strings->strings, ref);
+        uint64_t hash = table_hash(table, string, stored_length(string));
+        size_t offset = (size_t)(id - 1);
+        uint64_t *hashes = strings->hashes->pages[offset / hashes_per_page];
+        hashes[offset % hashes_per_page] = hash;
+        struct slot slot = {slot_hash(hash), id, {0}};
+        slot_key(slot.key, string, stored_length(string), ref);
+        table_insert(table, &slot, &probes);
+    }
+
+    replace_tables(strings, table);
+    return true;
+}
+
+bool strings_hash_key(struct strings *strings, const uint8_t key[16]) {
+    if (strings->total) {
+        return false;
+    }
+    uint64_t hash_key[2];
+    if (key) {
+        memcpy(hash_key, key, sizeof(hash_key));
+    } else if (!random_key(hash_key)) {
+        return false;
     }
-    return hash;
+    return rehash(strings, hash_key);
+}
+
+uint32_t strings_rehash_count(const struct strings *strings) {
+    return strings->rehashes;
+}
+
+uint32_t strings_generation(const struct strings *strings) {
+    return load_acquire(&strings->generation);
 }
 
 bool strings_hash_seed(struct strings *strings, uint32_t seed) {
     if (strings->total) {
         return false;
     }
-    strings->hash_seed = seed;
+    strings->table->hash_seed = seed;
     return true;
 }
 
-static tree_node_t *create_node(struct strings *strings, uint32_t hash,
-                                const char *string) {
-    tree_node_t *node = block_alloc(strings->index, sizeof(*node));
-    if (!node) {
-        return NULL;
+// Compare the string with an ID to another string. If prefix is true then
+// only the first len bytes of the stored string are compared, so that any
+// string starting with the other string compares as equal
+static int compare_id(const struct strings *strings, uint32_t id,
+                      const char *string, size_t len, bool prefix) {
+    const char *stored = ref_string(strings->strings,
+                                    id_ref(strings->refs, id));
+    size_t stored_len = stored_length(stored);
+    if (prefix && stored_len > len) {
+        stored_len = len;
     }
-    node->hash = hash;
-    node->next = NULL;
-    node->id = strings->total + 1;
-    if (node->id == id_overflow) {
+    return compare_strings(stored, stored_len, string, len);
+}
+
+// Store a string, its ref and its hash for the next ID. The ref and the
+// hash are allocated first, and are given back if the string can't be
+// stored, so that the three blocks always hold the same number of strings.
+// This function returns the ref, or NULL if an error occurred
+static const struct string_ref *store_string(struct strings *strings,
+                                             uint64_t hash, const char *string,
+                                             size_t len) {
+    string_header_t header = len;
+    if (header != len) {
         return NULL;
     }
-
-    size_t len = strlen(string);
-    void *string_ptr = block_alloc(strings->strings, len + 1);
+    struct block_snapshot refs_snapshot, hashes_snapshot;
+    block_snapshot(strings->refs, &refs_snapshot);
+    block_snapshot(strings->hashes, &hashes_snapshot);
+    struct string_ref *ref = block_alloc(strings->refs, sizeof(*ref));
+    uint64_t *hash_ptr = NULL;
+    char *string_ptr = NULL;
+    if (ref) {
+        hash_ptr = block_alloc(strings->hashes, sizeof(*hash_ptr));
+    }
+    if (hash_ptr) {
+        string_ptr = block_alloc(strings->strings, sizeof(header) + len + 1);
+    }
     if (!string_ptr) {
+        block_restore(strings->refs, &refs_snapshot);
+        block_restore(strings->hashes, &hashes_snapshot);
         return NULL;
     }
-    memcpy(string_ptr, string, len + 1);
-    node->string = (const char *)string_ptr;
+    memcpy(string_ptr, &header, sizeof(header));
+    memcpy(string_ptr + sizeof(header), string, len);
+    string_ptr[sizeof(header) + len] = '\0';
 
-    uint32_t *hash_ptr = block_alloc(strings->hashes, sizeof(*hash_ptr));
-    if (!hash_ptr) {
-        return NULL;
-    }
+    const struct block *block = strings->strings;
+    ref->page = block->count - 1;
+    ref->offset = (uintptr_t)string_ptr - (uintptr_t)block->pages[ref->page];
     *hash_ptr = hash;
-
-    strings->total++;
-
-    return node;
+    return ref;
 }
 
-static tree_node_t *find_node(const struct strings *strings, uint32_t hash) {
-    tree_node_t key;
-    key.hash = hash;
-    return tree_search(&strings->hash_map, &key);
+// Stored strings which were interned through the 64-bit API can have IDs
+// from id_overflow up, which the 32-bit API can't return since they would
+// be taken for inlined integers
+static inline uint32_t narrow_id(uint32_t id) {
+    return id_overflow && id >= id_overflow ? 0 : id;
 }
 
-__attribute__ ((noinline))
-static bool strings_intern_collision(struct strings *strings,
-                                     tree_node_t *node, const char *string,
-                                     uint32_t hash) {
-    for (;;) {
-        if (!node->next) {
-            node = node->next = create_node(strings, hash, string);
-            if (!node) {
-                return 0;
-            }
-            break;
+// Store a new string. Its ID can be beyond what the 32-bit API can return
+// if wide is true
+static uint32_t create_string(struct strings *strings, uint64_t hash,
+                              const char *string, size_t len, bool wide) {
+    if (!strings->table->growth_left && !grow_table(strings)) {
+        return 0;
+    }
+    uint32_t id = strings->total + 1;
+    if (!id || (!wide && !narrow_id(id))) {
+        return 0;
+    }
+
+    const struct string_ref *ref = store_string(strings, hash, string, len);
+    if (!ref) {
+        return 0;
+    }
+
+    // Repositories stay sorted for as long as strings are interned in order
+    if (strings->sorted == strings->total &&
+            (!strings->total ||
+             compare_id(strings, strings->total, string, len, false) < 0)) {
+        store_release(&strings->sorted, id);
+    }
+
+    // The string is published to readers by ID before it can be found in
+    // the table, so that an ID returned by a lookup can always be resolved
+    store_release(&strings->total, id);
+
+    size_t probes;
+    struct slot slot = {slot_hash(hash), id, {0}};
+    slot_key(slot.key, string, len, ref);
+    table_insert(strings->table, &slot, &probes);
+    store_release(&strings->indexed, id);
+
+    if (strings->old_table) {
+        migrate_group(strings);
+    }
+    if (strings->retired) {
+        reclaim_tables(strings);
+    }
+
+    if (probes > max_probes) {
+        uint64_t key[2];
+        if (random_key(key) && rehash(strings, key)) {
+            strings->rehashes++;
         }
-        node = node->next;
-        if (!strcmp(node->string, string)) {
-            break;
+    }
+
+    return id;
+}
+
+// Search the table, and then the old table if the table is growing. The
+// hash must be from the table's hash function. The tables must be loaded in
+// this order, since the writer publishes the old table before the table
+static const struct slot *find_slot(const struct strings *strings,
+                                    const struct table *table,
+                                    const struct table *old_table,
+                                    uint64_t hash, const char *string,
+                                    size_t len) {
+    const struct slot *slot = table_find(table, strings->strings,
+                                         slot_hash(hash), string, len);
+    if (!slot && old_table) {
+        if (!same_hash(table, old_table)) {
+            hash = table_hash(old_table, string, len);
         }
+        slot = table_find(old_table, strings->strings, slot_hash(hash),
+                          string, len);
     }
-    return node->id;
+    return slot;
+}
+
+// Find the slot for a string, also getting its hash from the current table
+static const struct slot *lookup_slot(const struct strings *strings,
+                                      const char *string, size_t len,
+                                      uint64_t *hash) {
+    const struct table *table = load_acquire(&strings->table);
+    const struct table *old_table = load_acquire(&strings->old_table);
+    *hash = table_hash(table, string, len);
+    return find_slot(strings, table, old_table, *hash, string, len);
 }
 
 uint32_t strings_count(const struct strings *strings) {
-    return strings->total;
+    return load_acquire(&strings->total);
 }
 
 uint32_t strings_intern(struct strings *strings, const char *string) {
-#ifdef INLINE_UNSIGNED
-    if (is_small_unsigned(string)) {
-        uint32_t number = to_unsigned(string);
-        if (number < unsigned_tag) {
-            return number | unsigned_tag;
+    return strings_intern_len(strings, string, strlen(string));
+}
+
+static uint32_t intern_stored(struct strings *strings, const char *string,
+                              size_t len, bool wide) {
+    uint64_t hash;
+    const struct slot *slot = lookup_slot(strings, string, len, &hash);
+    if (slot) {
+        return wide ? slot->id : narrow_id(slot->id);
+    }
+    return create_string(strings, hash, string, len, wide);
+}
+
+uint32_t strings_intern_len(struct strings *strings, const char *string,
+                            size_t len) {
+    uint32_t id = inline_id(string, len);
+    if (id) {
+        return id;
+    }
+    return intern_stored(strings, string, len, false);
+}
+
+uint32_t strings_lookup(const struct strings *strings, const char *string) {
+    return strings_lookup_len(strings, string, strlen(string));
+}
+
+uint32_t strings_lookup_len(const struct strings *strings, const char *string,
+                            size_t len) {
+    uint32_t id = inline_id(string, len);
+    if (id) {
+        return id;
+    }
+    uint64_t hash;
+    const struct slot *slot = lookup_slot(strings, string, len, &hash);
+    return slot ? narrow_id(slot->id) : 0;
+}
+
+// 64-bit IDs have a tag in their top two bits. Stored strings have a tag
+// of zero and their regular ID. Strings of up to 7 bytes are packed into
+// the low 56 bits, with their length above that. Integers in canonical
+// decimal form (no sign unless negative, and no leading zeros) are stored
+// as a 62-bit magnitude, which is one less than the magnitude for negative
+// integers so that -2^62 fits. Integers take priority over short strings,
+// so that every string has exactly one ID
+static const uint64_t id64_tag_mask = 3ULL << 62;
+static const uint64_t id64_short = 1ULL << 62;
+static const uint64_t id64_unsigned = 2ULL << 62;
+static const uint64_t id64_negative = 3ULL << 62;
+static const uint64_t id64_magnitude_limit = 1ULL << 62;
+static const size_t id64_short_max = 7;
+
+// Parse a canonical decimal integer, setting its magnitude
+static bool parse_integer(const char *string, size_t len, bool *negative,
+                          uint64_t *magnitude) {
+    *negative = len && string[0] == '-';
+    if (*negative) {
+        string++;
+        len--;
+    }
+    // 2^62 has 19 digits, so 19 digits can't overflow
+    if (!len || len > 19 || (string[0] == '0' && (len > 1 || *negative))) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (string[i] < '0' || string[i] > '9') {
+            return false;
         }
+        value = value * 10 + (string[i] - '0');
     }
-#endif
+    *magnitude = value;
+    return *negative ? value <= id64_magnitude_limit :
+        value < id64_magnitude_limit;
+}
 
-    uint32_t hash = strings_hash(strings, string);
-    tree_node_t *node = find_node(strings, hash);
-    if (node) {
-        if (strcmp(node->string, string)) {
-            return strings_intern_collision(strings, node, string, hash);
+// Get the inlined 64-bit ID for a string, or zero if it can't be inlined
+static uint64_t inline_id64(const char *string, size_t len) {
+    bool negative;
+    uint64_t magnitude;
+    if (parse_integer(string, len, &negative, &magnitude)) {
+        return negative ? id64_negative | (magnitude - 1) :
+            id64_unsigned | magnitude;
+    }
+    if (len <= id64_short_max) {
+        uint64_t id = id64_short | (uint64_t)len << 56;
+        for (size_t i = 0; i < len; i++) {
+            id |= (uint64_t)(uint8_t)string[i] << (8 * i);
         }
-    } else {
-        if (!(node = create_node(strings, hash, string))) {
-            return 0;
+        return id;
+    }
+    return 0;
+}
+
+uint64_t strings_intern64_len(struct strings *strings, const char *string,
+                              size_t len) {
+    uint64_t id = inline_id64(string, len);
+    if (id) {
+        return id;
+    }
+    return intern_stored(strings, string, len, true);
+}
+
+uint64_t strings_intern64(struct strings *strings, const char *string) {
+    return strings_intern64_len(strings, string, strlen(string));
+}
+
+uint64_t strings_lookup64_len(const struct strings *strings,
+                              const char *string, size_t len) {
+    uint64_t id = inline_id64(string, len);
+    if (id) {
+        return id;
+    }
+    uint64_t hash;
+    const struct slot *slot = lookup_slot(strings, string, len, &hash);
+    return slot ? slot->id : 0;
+}
+
+uint64_t strings_lookup64(const struct strings *strings, const char *string) {
+    return strings_lookup64_len(strings, string, strlen(string));
+}
+
+const char *strings_lookup_id64_len(struct strings *strings, uint64_t id,
+                                    size_t *len) {
+    char *buffer = strings->buffer64;
+    uint64_t tag = id & id64_tag_mask;
+    uint64_t value = id & ~id64_tag_mask;
+    if (tag == id64_short) {
+        *len = value >> 56;
+        if (*len > id64_short_max) {
+            return NULL;
+        }
+        for (size_t i = 0; i < *len; i++) {
+            buffer[i] = (char)(value >> (8 * i));
         }
-        tree_insert(&strings->hash_map, node);
+        buffer[*len] = '\0';
+        return buffer;
+    } else if (tag == id64_unsigned) {
+        *len = unsigned64_string(buffer, value);
+        return buffer;
+    } else if (tag == id64_negative) {
+        buffer[0] = '-';
+        *len = unsigned64_string(buffer + 1, value + 1) + 1;
+        return buffer;
+    }
+    if (!id || id > strings_count(strings)) {
+        return NULL;
     }
+    const char *string = ref_string(strings->strings,
+                                    id_ref(strings->refs, id));
+    *len = stored_length(string);
+    return string;
+}
 
-    return node->id;
+const char *strings_lookup_id64(struct strings *strings, uint64_t id) {
+    size_t len;
+    return strings_lookup_id64_len(strings, id, &len);
 }
 
-uint32_t strings_lookup(const struct strings *strings, const char *string) {
-#ifdef INLINE_UNSIGNED
-    if (is_small_unsigned(string)) {
-        uint32_t number = to_unsigned(string);
-        if (number < unsigned_tag) {
-            return number | unsigned_tag;
+// Hash a batch of strings and prefetch the index groups they map to, and
+// then the first candidate string in each group, so that the cache misses
+// for the whole batch overlap rather than being paid one string at a time.
+// Strings which are inlined have their ID written out, and are otherwise
+// given an ID of zero
+static void prefetch_batch(const struct table *table,
+                           const struct block *strings, const char **strs,
+                           const size_t *lens, size_t n, size_t *batch_lens,
+                           uint64_t *hashes, uint32_t *ids) {
+    for (size_t i = 0; i < n; i++) {
+        batch_lens[i] = lens ? lens[i] : strlen(strs[i]);
+        ids[i] = inline_id(strs[i], batch_lens[i]);
+        if (ids[i]) {
+            continue;
         }
+        hashes[i] = table_hash(table, strs[i], batch_lens[i]);
+        size_t group = slot_hash(hashes[i]) & table->group_mask;
+        __builtin_prefetch(table->ctrl + group * GROUP_WIDTH);
+        __builtin_prefetch(table->slots + group * GROUP_WIDTH);
     }
-#endif
+    for (size_t i = 0; i < n; i++) {
+        if (ids[i]) {
+            continue;
+        }
+        uint32_t hash = slot_hash(hashes[i]);
+        size_t group = hash & table->group_mask;
+        uint64_t ctrl = group_load_acquire(table->ctrl + group * GROUP_WIDTH);
+        uint64_t match = group_match(ctrl, slot_tag(hash));
+        // Short strings are in their slots, so only long strings are
+        // prefetched. Getting a compressed string would decompress its
+        // page, which is more work than the prefetch saves, and would evict
+        // pages that the batch still needs
+        if (match && batch_lens[i] > inline_key_max &&
+                !strings->compression) {
+            size_t index = group * GROUP_WIDTH + group_mask_index(match);
+            const struct slot *slot = &table->slots[index];
+            if (slot->key[0] == long_key) {
+                struct string_ref ref = slot_ref(slot);
+                __builtin_prefetch(ref_string(strings, &ref));
+            }
+        }
+    }
+}
 
-    uint32_t hash = strings_hash(strings, string);
-    tree_node_t *node = find_node(strings, hash);
-    if (node) {
-        do {
-            if (!strcmp(node->string, string)) {
-                return node->id;
+bool strings_intern_batch(struct strings *strings, const char **strs,
+                          const size_t *lens, uint32_t *ids, size_t n) {
+    uint64_t hashes[BATCH_SIZE];
+    size_t batch_lens[BATCH_SIZE];
+    bool ok = true;
+    for (size_t start = 0; start < n; start += BATCH_SIZE) {
+        size_t count = n - start < BATCH_SIZE ? n - start : BATCH_SIZE;
+        const char **batch = strs + start;
+        uint32_t *batch_ids = ids + start;
+        prefetch_batch(strings->table, strings->strings, batch,
+                       lens ? lens + start : NULL, count, batch_lens, hashes,
+                       batch_ids);
+        uint32_t rehashes = strings->rehashes;
+        for (size_t i = 0; i < count; i++) {
+            if (batch_ids[i]) {
+                continue;
+            }
+            if (strings->rehashes != rehashes) {
+                hashes[i] = table_hash(strings->table, batch[i],
+                                       batch_lens[i]);
+            }
+            const struct slot *slot =
+                find_slot(strings, strings->table, strings->old_table,
+                          hashes[i], batch[i], batch_lens[i]);
+            if (slot) {
+                batch_ids[i] = narrow_id(slot->id);
+            } else {
+                batch_ids[i] = create_string(strings, hashes[i], batch[i],
+                                             batch_lens[i], false);
             }
-        } while ((node = node->next));
+            ok = ok && batch_ids[i];
+        }
     }
+    return ok;
+}
 
-    return 0;
+void strings_lookup_batch(const struct strings *strings, const char **strs,
+                          const size_t *lens, uint32_t *ids, size_t n) {
+    uint64_t hashes[BATCH_SIZE];
+    size_t batch_lens[BATCH_SIZE];
+    for (size_t start = 0; start < n; start += BATCH_SIZE) {
+        size_t count = n - start < BATCH_SIZE ? n - start : BATCH_SIZE;
+        const char **batch = strs + start;
+        uint32_t *batch_ids = ids + start;
+        const struct table *table = load_acquire(&strings->table);
+        const struct table *old_table = load_acquire(&strings->old_table);
+        prefetch_batch(table, strings->strings, batch,
+                       lens ? lens + start : NULL, count, batch_lens, hashes,
+                       batch_ids);
+        for (size_t i = 0; i < count; i++) {
+            if (batch_ids[i]) {
+                continue;
+            }
+            const struct slot *slot = find_slot(strings, table, old_table,
+                                                hashes[i], batch[i],
+                                                batch_lens[i]);
+            batch_ids[i] = slot ? narrow_id(slot->id) : 0;
+        }
+    }
 }
 
 const char *strings_lookup_id(struct strings *strings, uint32_t id) {
@@ -247,52 +1207,132 @@ const char *strings_lookup_id(struct strings *strings, uint32_t id) {
     }
 #endif
 
-    if (id > strings->total) {
+    if (!id || id > strings_count(strings)) {
         return NULL;
     }
 
-    size_t hashes_per_page = PAGE_SIZE / sizeof(uint32_t);
-    size_t offset = (size_t)(id - 1);
-    size_t page_num = offset / hashes_per_page;
-    size_t page_offset = offset % hashes_per_page;
-    void *page = strings->hashes->pages[page_num];
-    uint32_t hash =
-        *(const uint32_t *)((uintptr_t)page + page_offset * sizeof(uint32_t));
+    return ref_string(strings->strings, id_ref(strings->refs, id));
+}
+
+const char *strings_lookup_id_len(struct strings *strings, uint32_t id,
+                                  size_t *len) {
+#ifdef INLINE_UNSIGNED
+    if (id & unsigned_tag) {
+        *len = unsigned_string(strings->buffer, id & ~unsigned_tag);
+        return strings->buffer;
+    }
+#endif
 
-    tree_node_t *node = find_node(strings, hash);
-    do {
-        if (node->id == id) {
-            return node->string;
+    if (!id || id > strings_count(strings)) {
+        return NULL;
+    }
+
+    const char *string = ref_string(strings->strings,
+                                    id_ref(strings->refs, id));
+    *len = stored_length(string);
+    return string;
+}
+
+// Decode a column of IDs, writing either offsets or lengths. IDs are
+// processed in batches: the ID table entries for the batch are prefetched,
+// then the strings they point to, and finally the strings are copied out
+static size_t decode_column(const struct strings *strings, const uint32_t *ids,
+                            size_t n, char *data, size_t capacity,
+                            uint32_t *offsets, uint32_t *lens) {
+    const char *batch[BATCH_SIZE];
+    uint32_t total = strings_count(strings);
+    size_t position = 0;
+    if (capacity > UINT32_MAX) {
+        capacity = UINT32_MAX;
+    }
+    for (size_t start = 0; start < n; start += BATCH_SIZE) {
+        size_t count = n - start < BATCH_SIZE ? n - start : BATCH_SIZE;
+        const uint32_t *batch_ids = ids + start;
+        for (size_t i = 0; i < count; i++) {
+            uint32_t id = batch_ids[i];
+            if (id && id <= total) {
+                __builtin_prefetch(id_ref(strings->refs, id));
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            uint32_t id = batch_ids[i];
+            if (id && id <= total) {
+                batch[i] = ref_string(strings->strings,
+                                      id_ref(strings->refs, id));
+                __builtin_prefetch(batch[i] - sizeof(string_header_t));
+            } else {
+                batch[i] = NULL;
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t len = 0;
+            if (batch[i]) {
+                len = stored_length(batch[i]);
+                if (capacity - position < len) {
+                    goto done;
+                }
+                memcpy(data + position, batch[i], len);
+            }
+#ifdef INLINE_UNSIGNED
+            else if (batch_ids[i] & unsigned_tag) {
+                uint32_t number = batch_ids[i] & ~unsigned_tag;
+                if (capacity - position > 10) {
+                    len = unsigned_string(data + position, number);
+                } else {
+                    char buffer[11];
+                    len = unsigned_string(buffer, number);
+                    if (capacity - position < len) {
+                        goto done;
+                    }
+                    memcpy(data + position, buffer, len);
+                }
+            }
+#endif
+            if (offsets) {
+                offsets[start + i] = position;
+            } else {
+                lens[start + i] = len;
+            }
+            position += len;
+            continue;
+done:
+            if (offsets) {
+                offsets[start + i] = position;
+            }
+            return start + i;
         }
-    } while ((node = node->next));
+    }
+    if (offsets) {
+        offsets[n] = position;
+    }
+    return n;
+}
 
-    return NULL;
+size_t strings_decode_column(const struct strings *strings,
+                             const uint32_t *ids, size_t n, char *data,
+                             size_t capacity, uint32_t *offsets) {
+    return decode_column(strings, ids, n, data, capacity, offsets, NULL);
+}
+
+size_t strings_decode_column_len(const struct strings *strings,
+                                 const uint32_t *ids, size_t n, char *data,
+                                 size_t capacity, uint32_t *lens) {
+    return decode_column(strings, ids, n, data, capacity, NULL, lens);
 }
 
 void strings_cursor_init(struct strings_cursor *cursor,
                          const struct strings *strings) {
-    cursor->strings = strings->strings;
-    cursor->page = 0;
-    cursor->offset = 0;
+    cursor->strings = strings;
+    cursor->position = 0;
     cursor->id = 0;
 }
 
 bool strings_cursor_next(struct strings_cursor *cursor) {
-    const struct block *block = cursor->strings;
-    if (cursor->id) {
-        const char *string = strings_cursor_string(cursor);
-        cursor->offset += strlen(string) + 1;
-        if (cursor->offset >= block->offsets[cursor->page]) {
-            cursor->page++;
-            cursor->offset = 0;
-        }
-    }
-    if (cursor->page >= block->count ||
-            cursor->offset >= block->offsets[cursor->page]) {
+    if (cursor->position >= strings_count(cursor->strings)) {
         cursor->id = 0;
         return false;
     }
-    cursor->id++;
+    cursor->id = ++cursor->position;
     return true;
 }
 
@@ -300,8 +1340,25 @@ const char *strings_cursor_string(const struct strings_cursor *cursor) {
     if (!cursor->id) {
         return NULL;
     }
-    const void *page = cursor->strings->pages[cursor->page];
-    return (const char *)((uintptr_t)page + cursor->offset);
+    const struct strings *strings = cursor->strings;
+    return ref_string(strings->strings, id_ref(strings->refs, cursor->id));
+}
+
+size_t strings_cursor_length(const struct strings_cursor *cursor) {
+    if (!cursor->id) {
+        return 0;
+    }
+    return stored_length(strings_cursor_string(cursor));
+}
+
+bool strings_cursor_seek(struct strings_cursor *cursor, uint32_t id) {
+    if (!id || id > strings_count(cursor->strings)) {
+        cursor->id = 0;
+        return false;
+    }
+    cursor->position = id;
+    cursor->id = id;
+    return true;
 }
 
 uint32_t strings_cursor_id(const struct strings_cursor *cursor) {
@@ -312,48 +1369,565 @@ void strings_snapshot(const struct strings *strings,
                       struct strings_snapshot *snapshot) {
     block_snapshot(strings->strings, &snapshot->strings);
     block_snapshot(strings->hashes, &snapshot->hashes);
-    block_snapshot(strings->index, &snapshot->index);
-    snapshot->total = strings->total;
+    block_snapshot(strings->refs, &snapshot->refs);
+    snapshot->total = strings_count(strings);
+}
+
+// Remove the strings with IDs after a snapshot from the tables, using the
+// stored hash of each string to find its slot. This costs time proportional
+// to the number of strings removed rather than the size of the repository
+static void remove_strings(struct strings *strings, uint32_t from_id,
+                           uint32_t to_id) {
+    size_t hashes_per_page = PAGE_SIZE / sizeof(uint64_t);
+    for (uint32_t id = to_id; id > from_id; id--) {
+        size_t offset = (size_t)(id - 1);
+        const uint64_t *hashes =
+            block_page(strings->hashes, offset / hashes_per_page);
+        uint32_t hash = slot_hash(hashes[offset % hashes_per_page]);
+        // Slots are copied rather than moved when a growing table is
+        // migrated, so a string can be in both tables
+        table_remove(strings->table, hash, id);
+        if (strings->old_table) {
+            table_remove(strings->old_table, hash, id);
+        }
+    }
 }
 
 bool strings_restore(struct strings *strings,
                      const struct strings_snapshot *snapshot) {
-    struct block *block = strings->index;
-    if (snapshot->index.count == block->count &&
-            snapshot->index.offset == block->offsets[block->count - 1]) {
+    if (snapshot->total == strings->total) {
         return true;
     }
+    if (snapshot->total > strings->total) {
+        return false;
+    }
 
-    if (!block_restore(strings->strings, &snapshot->strings) ||
-            !block_restore(strings->hashes, &snapshot->hashes) ||
-            !block_restore(strings->index, &snapshot->index)) {
+    // Strings that a pinned version can see are never removed. The total
+    // is lowered before versions are checked, which pairs with
+    // strings_version_pin()
+    uint32_t total = strings->total;
+    if (pinned_beyond(strings, snapshot->total)) {
         return false;
     }
-    strings->total = snapshot->total;
-    tree_new(&strings->hash_map);
-    tree_node_t *node, *existing;
-    for (size_t page = 0; page < block->count; page++) {
-        for (size_t offset = 0; offset < block->offsets[page];
-                offset += sizeof(tree_node_t)) {
-            node = (tree_node_t *)((uintptr_t)block->pages[page] + offset);
-            existing = find_node(strings, node->hash);
-            if (existing) {
-                while (existing->next) {
-                    existing = existing->next;
-                }
-                existing->next = node;
-            } else {
-                tree_insert(&strings->hash_map, node);
-            }
+    __atomic_store_n(&strings->total, snapshot->total, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (pinned_beyond(strings, snapshot->total) ||
+            !block_restore(strings->strings, &snapshot->strings)) {
+        store_release(&strings->total, total);
+        return false;
+    }
+    store_release(&strings->indexed, snapshot->total);
+    store_release(&strings->generation, strings->generation + 1);
+    if (strings->sorted > strings->total) {
+        store_release(&strings->sorted, strings->total);
+    }
+
+    // The hashes of the removed strings are needed to find their slots, so
+    // the hashes are restored last
+    remove_strings(strings, snapshot->total, total);
+    return block_restore(strings->hashes, &snapshot->hashes) &&
+        block_restore(strings->refs, &snapshot->refs);
+}
+
+struct strings *strings_reorder(const struct strings *strings,
+                                const uint32_t *ids, uint32_t count,
+                                uint32_t *remap) {
+    uint32_t total = strings->total;
+    if (count > total) {
+        return NULL;
+    }
+    // The new index is sized for every string up front and uses the same
+    // hash function, so strings are neither rehashed nor looked up, and the
+    // index never grows. Slots are collected and inserted together
+    uint64_t *seen = calloc((size_t)total / 64 + 1, sizeof(*seen));
+    struct slot *slots = malloc(sizeof(*slots) * (count ? count : 1));
+    struct strings *reordered = seen && slots ? strings_new() : NULL;
+    struct table *table = NULL;
+    if (reordered) {
+        table = table_new(table_groups(count), strings->table);
+    }
+    if (!table) {
+        goto error;
+    }
+    table_free(reordered->table);
+    reordered->table = table;
+    if (remap) {
+        memset(remap, 0, sizeof(*remap) * ((size_t)total + 1));
+    }
+
+    size_t hashes_per_page = PAGE_SIZE / sizeof(uint64_t);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t id = ids[i];
+        if (!id || id > total || seen[id / 64] & (1ULL << id % 64)) {
+            goto error;
+        }
+        seen[id / 64] |= 1ULL << id % 64;
+        // IDs are usually in no particular order, so the refs of later IDs
+        // are prefetched, and then their strings once the refs have arrived
+        if (i + BATCH_SIZE < count && ids[i + BATCH_SIZE] - 1 < total) {
+            __builtin_prefetch(id_ref(strings->refs, ids[i + BATCH_SIZE]));
+        }
+        if (i + BATCH_SIZE / 2 < count && ids[i + BATCH_SIZE / 2] - 1 < total &&
+                !strings_compressed(strings)) {
+            __builtin_prefetch(ref_string(
+                strings->strings, id_ref(strings->refs,
+                                         ids[i + BATCH_SIZE / 2])));
+        }
+        const char *string = ref_string(strings->strings,
+                                        id_ref(strings->refs, id));
+        size_t len = stored_length(string);
+        size_t offset = (size_t)(id - 1);
+        const uint64_t *hashes = block_page(strings->hashes,
+                                            offset / hashes_per_page);
+        uint64_t hash = hashes[offset % hashes_per_page];
+        const struct string_ref *ref = store_string(reordered, hash, string,
+                                                    len);
+        if (!ref) {
+            goto error;
+        }
+        if (reordered->sorted == i &&
+                (!i || compare_id(reordered, i, string, len, false) < 0)) {
+            reordered->sorted = i + 1;
+        }
+        slots[i].hash = slot_hash(hash);
+        slots[i].id = i + 1;
+        slot_key(slots[i].key, string, len, ref);
+        if (remap) {
+            remap[id] = i + 1;
+        }
+    }
+    if (!table_insert_bulk(table, slots, count)) {
+        goto error;
+    }
+    reordered->total = count;
+    reordered->indexed = count;
+    free(seen);
+    free(slots);
+    return reordered;
+
+error:
+    free(seen);
+    free(slots);
+    if (reordered) {
+        strings_free(reordered);
+    }
+    return NULL;
+}
+
+// Strings are sorted by the first 8 bytes after the prefix they all share,
+// with a radix sort, and then runs with the same 8 bytes are sorted by
+// comparing the rest of the strings. This keeps most of the sort within the
+// entries array rather than chasing pointers to the strings. Entries point
+// past the shared prefix
+struct sort_entry {
+    uint64_t key;
+    const char *string;
+    uint32_t len;
+    uint32_t id;
+};
+
+static int sort_comparator(const void *a_, const void *b_) {
+    const struct sort_entry *a = a_;
+    const struct sort_entry *b = b_;
+    return compare_strings(a->string, a->len, b->string, b->len);
+}
+
+static uint64_t sort_key(const char *string, size_t len) {
+    uint64_t key = 0;
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key = key << 8 | (i < len ? (uint8_t)string[i] : 0);
+    }
+    return key;
+}
+
+static bool sort_entries(struct sort_entry *entries, size_t count) {
+    struct sort_entry *buffer = malloc(sizeof(*buffer) * count);
+    uint32_t *counts = malloc(sizeof(*counts) * 65536);
+    if (!buffer || !counts) {
+        free(buffer);
+        free(counts);
+        return false;
+    }
+    for (int shift = 0; shift < 64; shift += 16) {
+        memset(counts, 0, sizeof(*counts) * 65536);
+        for (size_t i = 0; i < count; i++) {
+            counts[(entries[i].key >> shift) & 0xFFFF]++;
+        }
+        uint32_t position = 0;
+        for (size_t digit = 0; digit < 65536; digit++) {
+            uint32_t digit_count = counts[digit];
+            counts[digit] = position;
+            position += digit_count;
+        }
+        for (size_t i = 0; i < count; i++) {
+            buffer[counts[(entries[i].key >> shift) & 0xFFFF]++] = entries[i];
+        }
+        struct sort_entry *swap = entries;
+        entries = buffer;
+        buffer = swap;
+    }
+    // There are an even number of passes, so the result is back in entries
+    free(buffer);
+    free(counts);
+    for (size_t i = 0; i < count;) {
+        size_t end = i + 1;
+        while (end < count && entries[end].key == entries[i].key) {
+            end++;
+        }
+        if (end - i > 1) {
+            qsort(entries + i, end - i, sizeof(*entries), sort_comparator);
+        }
+        i = end;
+    }
+    return true;
+}
+
+struct strings *strings_sort(const struct strings *strings, uint32_t *remap) {
+    // Every string is needed at once
+    if (strings_compressed(strings)) {
+        return NULL;
+    }
+    uint32_t total = strings->total;
+    struct sort_entry *entries = malloc(sizeof(*entries) * (total ? total : 1));
+    if (!entries) {
+        return NULL;
+    }
+    size_t skip = SIZE_MAX;
+    const char *first = NULL;
+    for (uint32_t id = 1; id <= total; id++) {
+        const char *string = ref_string(strings->strings,
+                                        id_ref(strings->refs, id));
+        size_t len = stored_length(string);
+        entries[id - 1].string = string;
+        entries[id - 1].len = len;
+        entries[id - 1].id = id;
+        if (!first) {
+            first = string;
+            skip = len;
+        }
+        if (skip > len) {
+            skip = len;
+        }
+        while (skip && memcmp(first, string, skip)) {
+            skip--;
+        }
+    }
+    for (uint32_t i = 0; i < total; i++) {
+        entries[i].string += skip;
+        entries[i].len -= skip;
+        entries[i].key = sort_key(entries[i].string, entries[i].len);
+    }
+    uint32_t *ids = NULL;
+    if (sort_entries(entries, total)) {
+        ids = malloc(sizeof(*ids) * (total ? total : 1));
+    }
+    if (ids) {
+        for (uint32_t i = 0; i < total; i++) {
+            ids[i] = entries[i].id;
+        }
+    }
+    free(entries);
+    if (!ids) {
+        return NULL;
+    }
+    struct strings *sorted = strings_reorder(strings, ids, total, remap);
+    free(ids);
+    return sorted;
+}
+
+bool strings_sorted(const struct strings *strings) {
+    return load_acquire(&strings->sorted) == strings_count(strings);
+}
+
+// Find the first ID whose string is not ordered before another string. IDs
+// up to sorted must be in order
+static uint32_t lower_bound(const struct strings *strings, uint32_t sorted,
+                            const char *string, size_t len, bool prefix) {
+    uint32_t lo = 1, hi = sorted + 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int result = compare_id(strings, mid, string, len, prefix);
+        if (result < 0 || (prefix && !result)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool strings_range(const struct strings *strings, const char *lo_string,
+                   size_t lo_len, const char *hi_string, size_t hi_len,
+                   uint32_t *lo, uint32_t *hi) {
+    uint32_t sorted = load_acquire(&strings->sorted);
+    if (sorted != strings_count(strings)) {
+        return false;
+    }
+    *lo = lower_bound(strings, sorted, lo_string, lo_len, false);
+    *hi = lower_bound(strings, sorted, hi_string, hi_len, false);
+    if (*hi < *lo) {
+        *hi = *lo;
+    }
+    return true;
+}
+
+bool strings_prefix_range(const struct strings *strings, const char *prefix,
+                          size_t len, uint32_t *lo, uint32_t *hi) {
+    uint32_t sorted = load_acquire(&strings->sorted);
+    if (sorted != strings_count(strings)) {
+        return false;
+    }
+    *lo = lower_bound(strings, sorted, prefix, len, false);
+    *hi = lower_bound(strings, sorted, prefix, len, true);
+    return true;
+}
+
+// Saved repositories start with a header, followed by the pages of each
+// block and then the index, each section aligned to a file_alignment
+// boundary. Everything is stored in native byte order, which the magic
+// number checks, so that a file can be used in place once it's mapped
+static const uint64_t file_magic = 0x31304E5245544E49ULL;
+static const uint32_t file_version = 2;
+static const size_t file_alignment = 4096;
+#ifdef DJB2_HASH
+static const uint32_t file_hash = 1;
+#else
+static const uint32_t file_hash = 0;
+#endif
+
+enum { file_strings, file_hashes, file_refs, file_blocks };
+
+struct file_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t total;
+    uint32_t hash;
+    uint32_t keyed;
+    uint32_t sorted;
+    uint64_t hash_seed;
+    uint64_t hash_key[2];
+    uint64_t groups;
+    uint64_t growth_left;
+    uint64_t block_pages[file_blocks];
+    uint64_t block_offsets[file_blocks];
+    uint64_t block_sections[file_blocks];
+    uint64_t ctrl_section;
+    uint64_t slots_section;
+    uint64_t size;
+};
+
+static size_t file_align(size_t offset) {
+    return (offset + file_alignment - 1) / file_alignment * file_alignment;
+}
+
+static bool write_all(int fd, const void *buffer, size_t bytes) {
+    const char *ptr = buffer;
+    while (bytes) {
+        ssize_t written = write(fd, ptr, bytes);
+        if (written < 0) {
+            return false;
+        }
+        ptr += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+static bool write_zeros(int fd, size_t bytes) {
+    static const char zeros[4096];
+    while (bytes) {
+        size_t chunk = bytes < sizeof(zeros) ? bytes : sizeof(zeros);
+        if (!write_all(fd, zeros, chunk)) {
+            return false;
         }
+        bytes -= chunk;
     }
     return true;
 }
 
+// Write the used part of each page in a block, padding each page out to
+// the page size and the block out to the file alignment
+static bool write_block(int fd, const struct block *block) {
+    for (size_t i = 0; i < block->count; i++) {
+        size_t used = block->offsets[i];
+        if (!write_all(fd, block_page(block, i), used) ||
+                !write_zeros(fd, block->page_size - used)) {
+            return false;
+        }
+    }
+    size_t bytes = block->count * block->page_size;
+    return write_zeros(fd, file_align(bytes) - bytes);
+}
+
+bool strings_save(struct strings *strings, int fd) {
+    while (strings->old_table) {
+        migrate_group(strings);
+    }
+    const struct table *table = strings->table;
+    const struct block *blocks[file_blocks] = {
+        strings->strings, strings->hashes, strings->refs
+    };
+
+    struct file_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = file_magic;
+    header.version = file_version;
+    header.page_size = PAGE_SIZE;
+    header.total = strings->total;
+    header.sorted = strings->sorted;
+    header.hash = file_hash;
+    header.keyed = table->keyed;
+    header.hash_seed = table->hash_seed;
+    header.hash_key[0] = table->hash_key[0];
+    header.hash_key[1] = table->hash_key[1];
+    header.groups = table->group_mask + 1;
+    header.growth_left = table->growth_left;
+    size_t offset = file_align(sizeof(header));
+    for (size_t i = 0; i < file_blocks; i++) {
+        header.block_pages[i] = blocks[i]->count;
+        header.block_offsets[i] = blocks[i]->offsets[blocks[i]->count - 1];
+        header.block_sections[i] = offset;
+        offset += file_align(blocks[i]->count * PAGE_SIZE);
+    }
+    size_t capacity = header.groups * GROUP_WIDTH;
+    header.ctrl_section = offset;
+    offset += file_align(capacity);
+    header.slots_section = offset;
+    offset += file_align(capacity * sizeof(*table->slots));
+    header.size = offset;
+
+    if (!write_all(fd, &header, sizeof(header)) ||
+            !write_zeros(fd, file_align(sizeof(header)) - sizeof(header))) {
+        return false;
+    }
+    for (size_t i = 0; i < file_blocks; i++) {
+        if (!write_block(fd, blocks[i])) {
+            return false;
+        }
+    }
+    return write_all(fd, table->ctrl, capacity) &&
+        write_zeros(fd, file_align(capacity) - capacity) &&
+        write_all(fd, table->slots, capacity * sizeof(*table->slots)) &&
+        write_zeros(fd, file_align(capacity * sizeof(*table->slots)) -
+                    capacity * sizeof(*table->slots));
+}
+
+// Check that a header describes a file of the given size which this build
+// can use
+static bool valid_header(const struct file_header *header, size_t size) {
+    if (size < sizeof(*header) || header->magic != file_magic ||
+            header->version != file_version ||
+            header->page_size != PAGE_SIZE || header->hash != file_hash ||
+            header->sorted > header->total || header->size > size) {
+        return false;
+    }
+    uint64_t groups = header->groups;
+    if (!groups || groups & (groups - 1) ||
+            header->growth_left > groups * GROUP_WIDTH ||
+            header->ctrl_section + groups * GROUP_WIDTH > header->size ||
+            header->slots_section + groups * GROUP_WIDTH *
+                sizeof(struct slot) > header->size) {
+        return false;
+    }
+    for (size_t i = 0; i < file_blocks; i++) {
+        if (!header->block_pages[i] ||
+                header->block_offsets[i] > PAGE_SIZE ||
+                header->block_sections[i] + header->block_pages[i] *
+                    PAGE_SIZE > header->size) {
+            return false;
+        }
+    }
+    uint64_t refs = (header->block_pages[file_refs] - 1) * refs_per_page +
+        header->block_offsets[file_refs] / sizeof(struct string_ref);
+    return refs == header->total;
+}
+
+struct strings *strings_load_mmap(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || (size_t)info.st_size < sizeof(struct file_header)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = info.st_size;
+    // The mapping is private, so pages are shared with other processes
+    // (and the page cache) until they're written to
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+    const struct file_header *header = mapping;
+    if (!valid_header(header, size)) {
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    struct strings *strings = malloc(sizeof(*strings));
+    if (!strings) {
+        munmap(mapping, size);
+        return NULL;
+    }
+    memset(strings, 0, sizeof(*strings));
+    strings->mapping = mapping;
+    strings->mapping_size = size;
+    strings->epoch = 1;
+    strings->total = header->total;
+    strings->indexed = header->total;
+    strings->sorted = header->sorted;
+
+    struct block **blocks[file_blocks] = {
+        &strings->strings, &strings->hashes, &strings->refs
+    };
+    for (size_t i = 0; i < file_blocks; i++) {
+        void *pages = (char *)mapping + header->block_sections[i];
+        *blocks[i] = block_new_mapped(PAGE_SIZE, pages, header->block_pages[i],
+                                      header->block_offsets[i]);
+        if (!*blocks[i]) {
+            goto error;
+        }
+    }
+    // New strings go into fresh pages rather than the last mapped page
+    strings->strings->offsets[strings->strings->count - 1] = PAGE_SIZE;
+
+    struct table *table = malloc(sizeof(*table));
+    if (!table) {
+        goto error;
+    }
+    table->ctrl = (uint8_t *)mapping + header->ctrl_section;
+    table->slots = (struct slot *)((char *)mapping + header->slots_section);
+    table->group_mask = header->groups - 1;
+    table->growth_left = header->growth_left;
+    table->hash_seed = header->hash_seed;
+    table->hash_key[0] = header->hash_key[0];
+    table->hash_key[1] = header->hash_key[1];
+    table->keyed = header->keyed;
+    table->mapped = true;
+    strings->table = table;
+    return strings;
+
+error:
+    for (size_t i = 0; i < file_blocks; i++) {
+        if (*blocks[i]) {
+            block_free(*blocks[i]);
+        }
+    }
+    free(strings);
+    munmap(mapping, size);
+    return NULL;
+}
+
 size_t strings_allocated_bytes(const struct strings *strings) {
     return block_allocated_bytes(strings->strings) +
         block_allocated_bytes(strings->hashes) +
-        block_allocated_bytes(strings->index) +
+        block_allocated_bytes(strings->refs) +
+        table_bytes(strings->table) +
+        table_bytes(strings->old_table) +
         sizeof(*strings);
 }
 
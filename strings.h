@@ -10,6 +10,38 @@ struct strings;
 // Create a new repository of strings
 struct strings *strings_new(void);
 
+// Create a new repository whose string data is kept in a file rather than
+// in memory, for repositories that are larger than RAM. The index, IDs and
+// hashes stay in memory, while the kernel pages strings in and out of the
+// file. The file is only scratch space, and its contents are overwritten.
+// Use strings_save() to keep a repository. The file descriptor is
+// duplicated, so the caller can close it (and unlink the file). This
+// function returns NULL if an error occurred
+struct strings *strings_new_file(int fd);
+
+// Compress the repository's string data, for repositories where most
+// strings are rarely read after they're interned. Each page of strings is
+// compressed when it fills up (as are the pages which are already full),
+// and pages are decompressed into a cache of cache_pages pages when
+// strings on them are read, replacing the least recently used page.
+// Strings in the cache cost little more to read than uncompressed strings.
+// The index, IDs and hashes aren't compressed. The cache must have at
+// least 16 pages. Reading a string makes its page the most recently used,
+// as does filling the page up, so a string returned by the repository
+// stays valid while up to cache_pages - 1 other pages are read from or
+// filled up by interning. A repository with compressed strings must only
+// be used by one thread, since reads update the cache.
+// strings_sort() needs every string at once and returns NULL for a
+// compressed repository. This function returns false if the repository is
+// file-backed, is already compressed, or an error occurred
+bool strings_compress(struct strings*, size_t cache_pages);
+
+// Check whether the repository compresses its string data
+bool strings_compressed(const struct strings*);
+
+// Get the number of pages of strings that are compressed
+size_t strings_compressed_pages(const struct strings*);
+
 // Free a string repository
 void strings_free(struct strings*);
 
@@ -22,22 +54,104 @@ uint32_t strings_count(const struct strings*);
 // error occurred
 uint32_t strings_intern(struct strings*, const char *string);
 
+// Intern a string of the specified length. The string does not need to be
+// NULL-terminated and may contain NULL bytes
+uint32_t strings_intern_len(struct strings*, const char *string, size_t len);
+
 // Lookup the ID for a string. This function returns zero if the string
 // does not exist in the repository
 uint32_t strings_lookup(const struct strings*, const char *string);
 
+// Lookup the ID for a string of the specified length
+uint32_t strings_lookup_len(const struct strings*, const char *string,
+                            size_t len);
+
+// Intern a batch of n strings, writing their IDs to ids. The lengths of the
+// strings can be provided, or lens can be NULL if the strings are
+// NULL-terminated. Strings are hashed and their index entries are prefetched
+// in groups, which hides memory latency when interning many strings. This
+// function returns false if an error occurred, in which case the IDs of the
+// strings that couldn't be interned are zero
+bool strings_intern_batch(struct strings*, const char **strings,
+                          const size_t *lens, uint32_t *ids, size_t n);
+
+// Lookup the IDs for a batch of n strings. As with strings_lookup(), IDs
+// are zero for strings which do not exist in the repository
+void strings_lookup_batch(const struct strings*, const char **strings,
+                          const size_t *lens, uint32_t *ids, size_t n);
+
 // Lookup the string associated with an ID. This function returns NULL
 // if there is no string with that ID in the repository. If INLINE_UNSIGNED
 // was defined at compile time then the repository will inline unsigned
 // integers into the ID itself. When looking up the string associated with such
 // an ID, the integer is written into an internal buffer which persists until
-// the function is called again
+// the function is called again. Since the buffer is shared, readers in other
+// threads should decode inlined IDs with strings_decode_column() instead
 const char *strings_lookup_id(struct strings*, uint32_t id);
 
+// Lookup the string associated with an ID, and its length. The string is
+// always NULL-terminated, but may contain NULL bytes if it was interned with
+// strings_intern_len()
+const char *strings_lookup_id_len(struct strings*, uint32_t id, size_t *len);
+
+// Intern a string and get back a 64-bit ID. Strings of up to 7 bytes and
+// integers between -2^62 and 2^62 - 1 (in canonical decimal form, e.g. "42"
+// but not "042" or "+42") are inlined into the ID, so they're never stored
+// and don't count towards strings_count(). The top two bits of the ID are
+// a tag, so integers outside that range (the rest of the 64-bit range and
+// beyond) are stored like any other string. Stored strings get the same ID
+// as from strings_intern(), and up to 2^32 - 1 strings can be stored, even
+// with INLINE_UNSIGNED. The 32-bit API can only store 2^31 - 1 strings with
+// INLINE_UNSIGNED, since larger IDs would be taken for inlined integers,
+// so it returns zero for strings which the 64-bit API stored beyond that,
+// and their IDs must only be passed to the 64-bit API. Inlined IDs differ
+// from the 32-bit IDs of the same strings, so the two APIs shouldn't be
+// mixed for a single column. This function returns 0 if an error
+// occurred, including when the repository is full
+uint64_t strings_intern64(struct strings*, const char *string);
+
+// Intern a string of the specified length, and get back a 64-bit ID
+uint64_t strings_intern64_len(struct strings*, const char *string,
+                              size_t len);
+
+// Lookup the 64-bit ID for a string. This function returns zero if the
+// string can't be inlined and does not exist in the repository
+uint64_t strings_lookup64(const struct strings*, const char *string);
+
+// Lookup the 64-bit ID for a string of the specified length
+uint64_t strings_lookup64_len(const struct strings*, const char *string,
+                              size_t len);
+
+// Lookup the string associated with a 64-bit ID. Inlined strings are decoded
+// into an internal buffer which persists until the function is called again,
+// as with strings_lookup_id()
+const char *strings_lookup_id64(struct strings*, uint64_t id);
+
+// Lookup the string associated with a 64-bit ID, and its length
+const char *strings_lookup_id64_len(struct strings*, uint64_t id,
+                                    size_t *len);
+
+// Decode a column of n IDs into a contiguous buffer, as used by columnar
+// formats. Strings are written back to back into data, without NULL
+// terminators, and offsets[i] is set to the position of string i in data.
+// offsets needs room for n + 1 entries, since the end of the last string
+// decoded is also written. IDs which do not exist in the repository (e.g. 0)
+// decode as empty strings. Decoding stops if the next string does not fit
+// in the remaining capacity. This function returns the number of IDs
+// decoded, so that a large column can be decoded in chunks
+size_t strings_decode_column(const struct strings*, const uint32_t *ids,
+                             size_t n, char *data, size_t capacity,
+                             uint32_t *offsets);
+
+// Decode a column of n IDs like strings_decode_column(), but write the
+// length of each string to lens rather than writing offsets
+size_t strings_decode_column_len(const struct strings*, const uint32_t *ids,
+                                 size_t n, char *data, size_t capacity,
+                                 uint32_t *lens);
+
 struct strings_cursor {
-    const struct block *strings;
-    size_t page;
-    size_t offset;
+    const struct strings *strings;
+    uint32_t position;
     uint32_t id;
 };
 
@@ -47,15 +161,23 @@ void strings_cursor_init(struct strings_cursor*, const struct strings*);
 // Advance the cursor, e.g. while (strings_cursor_next(&cursor)) { ... }
 bool strings_cursor_next(struct strings_cursor*);
 
+// Move the cursor to the string with the specified ID, so that iteration
+// can start anywhere. This function returns false if there is no string
+// with that ID in the repository
+bool strings_cursor_seek(struct strings_cursor*, uint32_t id);
+
 // Select the string/ID that the cursor currently points to, or NULL/0 if
 // the cursor is invalid
 const char *strings_cursor_string(const struct strings_cursor*);
 uint32_t strings_cursor_id(const struct strings_cursor*);
 
+// Get the length of the string the cursor currently points to
+size_t strings_cursor_length(const struct strings_cursor*);
+
 struct strings_snapshot {
     struct block_snapshot strings;
     struct block_snapshot hashes;
-    struct block_snapshot index;
+    struct block_snapshot refs;
     uint32_t total;
 };
 
@@ -64,10 +186,134 @@ struct strings_snapshot {
 void strings_snapshot(const struct strings*, struct strings_snapshot*);
 
 // Restore the string repository to a previous position. Any strings added
-// after the snapshot are removed. This function returns true if the restore
-// was successful, and false if an error occurred
+// after the snapshot are removed, which takes time proportional to the
+// number of strings removed rather than the size of the repository. This
+// function returns true if the restore was successful, and false if an
+// error occurred. Once a restore has started, readers in other threads
+// must not access the strings being removed, including their IDs and any
+// pointers to them obtained earlier
 bool strings_restore(struct strings*, const struct strings_snapshot*);
 
+// Create a new repository with the same strings, with IDs assigned in
+// lexicographic (bytewise) order, so that IDs can be compared, sorted and
+// grouped in place of the strings. A string that's a prefix of another
+// string is ordered first. If remap is not NULL, it must have room for
+// strings_count() + 1 IDs, and remap[id] is set to the new ID of the string
+// with each old ID. This function returns NULL if an error occurred
+struct strings *strings_sort(const struct strings*, uint32_t *remap);
+
+// Create a new repository with the strings that have the count IDs in ids,
+// where the string with ids[i] gets the ID i + 1. Strings are copied along
+// with their stored hashes, into an index that's sized for them up front,
+// so nothing is rehashed or looked up. If remap is not NULL, it must have
+// room for strings_count() + 1 IDs, and remap[id] is set to the new ID of
+// the string with each old ID, or zero if it isn't in the new repository.
+// This function returns NULL if an error occurred, or if an ID is repeated
+// or doesn't exist
+struct strings *strings_reorder(const struct strings*, const uint32_t *ids,
+                                uint32_t count, uint32_t *remap);
+
+// Check whether every string's ID is in lexicographic order. This is the
+// case after strings_sort(), and stays the case for as long as strings are
+// interned in order
+bool strings_sorted(const struct strings*);
+
+// Find the range of IDs [*lo, *hi) whose strings start with a prefix, or
+// which are ordered at or after lo_string and before hi_string. The range
+// is empty if *lo == *hi. These functions return false if the repository
+// is not sorted
+bool strings_prefix_range(const struct strings*, const char *prefix,
+                          size_t len, uint32_t *lo, uint32_t *hi);
+bool strings_range(const struct strings*, const char *lo_string,
+                   size_t lo_len, const char *hi_string, size_t hi_len,
+                   uint32_t *lo, uint32_t *hi);
+
+// A repository can be shared by one writer thread and any number of reader
+// threads without locks, unless its strings are compressed. The writer may
+// call any function, while readers may call strings_count(),
+// strings_lookup(), strings_lookup_len(), strings_lookup_batch(),
+// strings_lookup_id(), strings_lookup_id_len(), strings_decode_column(),
+// the range functions and the cursor functions, but only between
+// strings_reader_enter() and strings_reader_exit().
+// Strings are published once they are fully written, and index memory
+// which is replaced as the repository grows is only freed once no reader
+// can be using it. A reader which stays entered delays that, so readers
+// should exit regularly, e.g. after each query
+struct strings_reader;
+
+// Register a reader. This can be called from the reader's thread, and
+// returns NULL if an error occurred
+struct strings_reader *strings_reader_new(struct strings*);
+
+// Unregister a reader. Its memory is reused by later readers, and is freed
+// with the repository
+void strings_reader_free(struct strings_reader*);
+
+// Enter and exit a read-side critical section. Strings, IDs and cursors
+// obtained inside a critical section remain valid after it exits, but
+// index memory does not
+void strings_reader_enter(struct strings_reader*);
+void strings_reader_exit(struct strings_reader*);
+
+// A version is a read-only view of the repository as of when it was pinned,
+// which sees the strings that existed then and none that are interned
+// later. Since strings are append-only, a version copies nothing, and the
+// writer can keep interning while versions are read. Strings that a pinned
+// version can see are never removed, so strings_restore() fails if it would
+// remove them. Versions can be pinned and read from reader threads, and
+// reading them follows the same rules as strings_lookup() and
+// strings_lookup_id(). Versions can't be pinned while the repository is
+// compressed, and the repository can't be compressed while a version is
+// pinned
+struct strings_version;
+
+// Pin a version of the repository. This function returns NULL if an error
+// occurred, or if the repository is compressed
+struct strings_version *strings_version_pin(struct strings*);
+
+// Unpin a version. Its memory is reused by later versions, and is freed with
+// the repository
+void strings_version_unpin(struct strings_version*);
+
+// Check whether any version of the repository is pinned, even a version of
+// an empty repository
+bool strings_version_pinned(const struct strings*);
+
+// Count the strings in a version
+uint32_t strings_version_count(const struct strings_version*);
+
+// Lookup the ID for a string in a version. This function returns zero if
+// the string does not exist in the version, even if it was interned since
+uint32_t strings_version_lookup(const struct strings_version*,
+                                const char *string);
+uint32_t strings_version_lookup_len(const struct strings_version*,
+                                    const char *string, size_t len);
+
+// Lookup the string associated with an ID in a version, returning NULL if
+// the ID is not in the version
+const char *strings_version_lookup_id(const struct strings_version*,
+                                      uint32_t id);
+const char *strings_version_lookup_id_len(const struct strings_version*,
+                                          uint32_t id, size_t *len);
+
+// Get a counter which changes whenever strings are removed from the
+// repository, i.e. when it's restored to an earlier snapshot. Anything that
+// caches IDs can use this to detect that its entries may be stale
+uint32_t strings_generation(const struct strings*);
+
+// Save the repository to a file descriptor, in a format which can be
+// mapped back in by strings_load_mmap(). This function returns true if the
+// repository was saved, and false if an error occurred
+bool strings_save(struct strings*, int fd);
+
+// Load a repository saved by strings_save(). The file is mapped privately,
+// and the strings, the ID table and the index are used in place, so loading
+// does no work per string and the pages are shared with other processes
+// that load the same file. Strings interned after loading go into new
+// pages. The file must have been saved by a build with the same page size,
+// hash function and byte order. This function returns NULL if an error occurred
+struct strings *strings_load_mmap(const char *path);
+
 // Get the total bytes allocated, including overhead
 size_t strings_allocated_bytes(const struct strings*);
 
@@ -78,4 +324,15 @@ size_t strings_page_size();
 // repository
 bool strings_hash_seed(struct strings *strings, uint32_t seed);
 
+// Hash strings with SipHash and a secret 16 byte key, so that strings
+// can't be crafted to collide. If the key is NULL then a random key is
+// generated. This must be done before adding strings to the repository.
+// Repositories which aren't keyed switch to a random key automatically when
+// an abnormally long run of colliding strings is detected
+bool strings_hash_key(struct strings*, const uint8_t key[16]);
+
+// Get the number of times the repository detected colliding strings and
+// rehashed itself with a random key
+uint32_t strings_rehash_count(const struct strings*);
+
 #endif
@@ -0,0 +1,110 @@
+// Helpers shared by the hash tables of regular and shared repositories.
+// Both store strings with a length header, and index them with a table of
+// control byte groups whose slots begin with the high 32 bits of the hash
+
+#ifndef INTERN_TABLE_H_
+#define INTERN_TABLE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "group.h"
+
+#define load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define store_release(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+
+// Strings are stored with a length header and a trailing NULL byte, so that
+// they can be returned as C strings
+typedef uint32_t string_header_t;
+
+static inline size_t stored_length(const char *string) {
+    string_header_t len;
+    memcpy(&len, string - sizeof(len), sizeof(len));
+    return len;
+}
+
+// The maximum number of groups an insertion can probe before the
+// repository assumes it is being flooded with colliding strings. With a
+// good hash, even tables with hundreds of millions of slots rarely need
+// more than 40 probes at the maximum load factor
+static const size_t max_probes = 128;
+
+// Slots only hold the high 32 bits of each hash. The group index is taken
+// from the low bits of that, and the 7-bit tag from the high bits
+static inline uint32_t slot_hash(uint64_t hash) {
+    return (uint32_t)(hash >> 32);
+}
+
+static inline uint8_t slot_tag(uint32_t hash) {
+    return hash >> 25;
+}
+
+// Probe the groups for a slot hash, calling found() with the index of each
+// slot whose control byte matches the tag, until it returns true. This
+// function returns that index, or SIZE_MAX if the probe reached an empty
+// slot first. Control bytes are loaded with acquire semantics, so found()
+// can read the slot behind any byte that matches
+static inline size_t probe_find(const uint8_t *ctrl, size_t group_mask,
+                                uint32_t hash,
+                                bool (*found)(const void *, size_t),
+                                const void *context) {
+    uint8_t tag = slot_tag(hash);
+    size_t group = hash & group_mask;
+    for (size_t stride = 1;; stride++) {
+        uint64_t bytes = group_load_acquire(ctrl + group * GROUP_WIDTH);
+        uint64_t match = group_match(bytes, tag);
+        for (; match; match &= match - 1) {
+            size_t index = group * GROUP_WIDTH + group_mask_index(match);
+            if (found(context, index)) {
+                return index;
+            }
+        }
+        if (group_match_empty(bytes)) {
+            return SIZE_MAX;
+        }
+        group = (group + stride) & group_mask;
+    }
+}
+
+// Get the index of the first empty or deleted slot on the probe sequence
+// of a slot hash. The table must have a free slot. The number of groups
+// that had to be probed is written to probes
+static inline size_t probe_free(const uint8_t *ctrl, size_t group_mask,
+                                uint32_t hash, size_t *probes) {
+    size_t group = hash & group_mask;
+    uint64_t available;
+    size_t stride = 1;
+    for (;; stride++) {
+        available = group_match_empty_or_deleted(
+            group_load(ctrl + group * GROUP_WIDTH));
+        if (available) {
+            break;
+        }
+        group = (group + stride) & group_mask;
+    }
+    *probes = stride;
+    return group * GROUP_WIDTH + group_mask_index(available);
+}
+
+// Generate a random key for keyed hashing. This function returns false if
+// an error occurred
+static inline bool random_key(uint64_t key[2]) {
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__)
+    arc4random_buf(key, sizeof(uint64_t) * 2);
+    return true;
+#else
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t bytes = read(fd, key, sizeof(uint64_t) * 2);
+    close(fd);
+    return bytes == sizeof(uint64_t) * 2;
+#endif
+}
+
+#endif
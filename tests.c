@@ -1,16 +1,175 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/wait.h>
 
 #include "config.h"
 #include "strings.h"
 #include "optimize.h"
+#include "sharded.h"
+#include "queue.h"
+#include "cache.h"
+#include "delta.h"
+#include "shared.h"
+#include "frozen.h"
 #include "unsigned.h"
+#include "hash.h"
 
 #ifdef INLINE_UNSIGNED
 # include <limits.h>
 #endif
 
+// Look up strings from a reader thread while the main thread interns them
+static void *concurrent_reader(void *arg) {
+    struct strings *strings = arg;
+    struct strings_reader *reader = strings_reader_new(strings);
+    assert(reader);
+    char buffer[12] = {'y'};
+    uint32_t count = 0;
+    while (count < 200000) {
+        strings_reader_enter(reader);
+        count = strings_count(strings);
+        for (uint32_t id = count; id > 0 && id + 64 > count; id--) {
+            unsigned_string(buffer + 1, id);
+            const char *string = strings_lookup_id(strings, id);
+            assert(string && !strcmp(buffer, string));
+            // the newest string can be resolved by ID before it can be
+            // found by lookup
+            uint32_t found = strings_lookup(strings, buffer);
+            assert(found == id || (!found && id == count));
+        }
+        strings_reader_exit(reader);
+    }
+    strings_reader_free(reader);
+    return NULL;
+}
+
+// Pin versions from a reader thread while the main thread interns strings
+// and restores snapshots, checking that each version stays the same
+static void *version_reader(void *arg) {
+    struct strings *strings = arg;
+    struct strings_reader *reader = strings_reader_new(strings);
+    assert(reader);
+    char first[32], last[32];
+    uint32_t count = 0;
+    while (count < 100000) {
+        struct strings_version *version = strings_version_pin(strings);
+        assert(version);
+        count = strings_version_count(version);
+        if (!count) {
+            strings_version_unpin(version);
+            continue;
+        }
+        strings_reader_enter(reader);
+        strcpy(first, strings_version_lookup_id(version, 1));
+        strcpy(last, strings_version_lookup_id(version, count));
+        assert(!strings_version_lookup_id(version, count + 1));
+        strings_reader_exit(reader);
+        for (unsigned i = 0; i < 100; i++) {
+            strings_reader_enter(reader);
+            assert(strings_version_count(version) == count);
+            assert(!strcmp(strings_version_lookup_id(version, count), last));
+            assert(strings_version_lookup(version, first) == 1);
+            assert(strings_version_lookup(version, last) == count);
+            strings_reader_exit(reader);
+        }
+        strings_version_unpin(version);
+    }
+    strings_reader_free(reader);
+    return NULL;
+}
+
+struct sharded_interner {
+    struct strings_sharded *sharded;
+    uint32_t ids[50000];
+    unsigned offset;
+};
+
+// Intern the same strings as other threads, starting at a different offset
+static void *sharded_intern(void *arg) {
+    struct sharded_interner *interner = arg;
+    char buffer[12] = {'z'};
+    for (unsigned i = 0; i < 50000; i++) {
+        unsigned index = (i + interner->offset) % 50000;
+        unsigned_string(buffer + 1, index);
+        interner->ids[index] = strings_sharded_intern(interner->sharded,
+                                                      buffer);
+        assert(interner->ids[index]);
+    }
+    return NULL;
+}
+
+struct queue_producer {
+    struct strings_queue *queue;
+    uint32_t ids[20000];
+    char strings[20000][8];
+    unsigned offset;
+};
+
+// Intern the same strings as other producers through the queue, submitting
+// a window of requests at a time
+static void *queue_produce(void *arg) {
+    struct queue_producer *producer = arg;
+    struct strings_request requests[100];
+    for (unsigned i = 0; i < 20000; i += 100) {
+        for (unsigned j = 0; j < 100; j++) {
+            unsigned index = (i + j + producer->offset) % 20000;
+            char *string = producer->strings[index];
+            string[0] = 'q';
+            size_t len = 1 + unsigned_string(string + 1, index);
+            while (!strings_queue_submit(producer->queue, &requests[j],
+                                         string, len)) {
+                sched_yield();
+            }
+        }
+        for (unsigned j = 0; j < 100; j++) {
+            unsigned index = (i + j + producer->offset) % 20000;
+            producer->ids[index] = strings_queue_wait(producer->queue,
+                                                      &requests[j]);
+        }
+    }
+    return NULL;
+}
+
+struct delta_buffer {
+    char *data;
+    size_t size;
+    size_t position;
+};
+
+static bool delta_buffer_write(void *context, const void *data,
+                               size_t bytes) {
+    struct delta_buffer *buffer = context;
+    char *resized = realloc(buffer->data, buffer->size + bytes);
+    if (!resized) {
+        return false;
+    }
+    memcpy(resized + buffer->size, data, bytes);
+    buffer->data = resized;
+    buffer->size += bytes;
+    return true;
+}
+
+// Read in small chunks so that the importer has to refill its buffer
+static size_t delta_buffer_read(void *context, void *data, size_t bytes) {
+    struct delta_buffer *buffer = context;
+    size_t available = buffer->size - buffer->position;
+    if (bytes > available) {
+        bytes = available;
+    }
+    if (bytes > 1000) {
+        bytes = 1000;
+    }
+    memcpy(data, buffer->data + buffer->position, bytes);
+    buffer->position += bytes;
+    return bytes;
+}
+
 int main() {
     struct strings *strings = strings_new();
     assert(strings);
@@ -63,6 +222,21 @@ int main() {
     assert(!strings_cursor_id(&cursor));
     assert(!strings_cursor_string(&cursor));
 
+    // test seeking the cursor
+    assert(!strings_cursor_seek(&cursor, 0));
+    assert(!strings_cursor_seek(&cursor, count + 1));
+    assert(!strings_cursor_id(&cursor));
+    assert(strings_cursor_seek(&cursor, count / 2));
+    assert(strings_cursor_id(&cursor) == count / 2);
+    for (id = count / 2; id <= count; id++) {
+        unsigned_string(buffer + 1, id);
+        assert(strings_cursor_id(&cursor) == id);
+        assert(!strcmp(buffer, strings_cursor_string(&cursor)));
+        assert(strings_cursor_next(&cursor) == (id < count));
+    }
+    assert(!strings_lookup_id(strings, 0));
+    assert(!strings_lookup_id(strings, count + 1));
+
     // test optimizing strings
     struct strings *optimized;
     struct strings_frequency *freq = strings_frequency_new();
@@ -102,6 +276,67 @@ int main() {
     strings_frequency_free(freq);
     strings_free(optimized);
 
+    // test the mapping from old IDs to new IDs, with ties kept in ID order
+    // and counts that need both radix passes
+    uint32_t *id_remap = malloc(sizeof(*id_remap) * (count + 1));
+    assert(id_remap);
+    freq = strings_frequency_new();
+    assert(freq);
+    for (unsigned i = 0; i < 70000; i++) {
+        assert(strings_frequency_add(freq, 7));
+    }
+    assert(strings_frequency_add(freq, 9));
+    assert(strings_frequency_add(freq, 4));
+    assert(strings_frequency_add(freq, 8));
+    assert(strings_frequency_add(freq, 8));
+    optimized = strings_optimize_remap(strings, freq, id_remap);
+    assert(optimized);
+    assert(strings_count(optimized) == 4);
+    assert(id_remap[7] == 1 && id_remap[8] == 2 && id_remap[4] == 3 &&
+           id_remap[9] == 4);
+    assert(!id_remap[0] && !id_remap[1] && !id_remap[count]);
+    assert(strings_lookup(optimized, "x7") == 1);
+    assert(strings_lookup(optimized, "x9") == 4);
+    assert(strings_intern(optimized, "x10") == 5);
+    strings_free(optimized);
+    assert(strings_frequency_add(freq, 9));
+    assert(strings_frequency_add(freq, 9));
+    optimized = strings_optimize_remap(strings, freq, id_remap);
+    assert(optimized);
+    assert(id_remap[7] == 1 && id_remap[9] == 2 && id_remap[8] == 3 &&
+           id_remap[4] == 4);
+    strings_frequency_free(freq);
+    strings_free(optimized);
+    freq = strings_frequency_new();
+    assert(freq);
+    assert(strings_frequency_add(freq, count + 1));
+    assert(!strings_optimize(strings, freq));
+    strings_frequency_free(freq);
+
+    // test reordering strings, which copies them with their hashes
+    uint32_t reorder_ids[] = {5, 1, 3};
+    optimized = strings_reorder(strings, reorder_ids, 3, id_remap);
+    assert(optimized);
+    assert(strings_count(optimized) == 3);
+    assert(id_remap[5] == 1 && id_remap[1] == 2 && id_remap[3] == 3 &&
+           !id_remap[2]);
+    assert(!strcmp(strings_lookup_id(optimized, 2), "x1"));
+    assert(strings_lookup(optimized, "x3") == 3);
+    assert(!strings_lookup(optimized, "x2"));
+    assert(!strings_sorted(optimized));
+    strings_free(optimized);
+    uint32_t sorted_ids[] = {1, 10, 100};
+    optimized = strings_reorder(strings, sorted_ids, 3, NULL);
+    assert(optimized && strings_sorted(optimized));
+    strings_free(optimized);
+    uint32_t repeated_ids[] = {1, 2, 1};
+    assert(!strings_reorder(strings, repeated_ids, 3, NULL));
+    uint32_t missing_ids[] = {1, 0};
+    assert(!strings_reorder(strings, missing_ids, 2, NULL));
+    missing_ids[1] = count + 1;
+    assert(!strings_reorder(strings, missing_ids, 2, NULL));
+    free(id_remap);
+
     // test interning unsigned int strings
 #ifdef INLINE_UNSIGNED
     for (unsigned i = 1; i <= count; i++) {
@@ -123,13 +358,112 @@ int main() {
 #endif
     assert(strings_intern(strings, "2147483647") == expected);
 
+    // test interning strings with an explicit length
+    const char *slices = "x1x2x3foo\0barfoo";
+    size_t len;
+    assert(strings_intern_len(strings, slices, 2) == 1);
+    assert(strings_intern_len(strings, slices + 2, 2) == 2);
+    assert(strings_lookup_len(strings, slices + 4, 2) == 3);
+    assert(!strings_lookup_len(strings, slices + 6, 3));
+    uint32_t binary_id = strings_intern_len(strings, slices + 6, 7);
+    assert(binary_id && binary_id != expected);
+    assert(strings_intern_len(strings, slices + 6, 7) == binary_id);
+    assert(strings_lookup_len(strings, slices + 6, 7) == binary_id);
+    assert(!strings_lookup(strings, "foo"));
+    string = strings_lookup_id_len(strings, binary_id, &len);
+    assert(string && len == 7 && !memcmp(string, slices + 6, 7) && !string[7]);
+    assert(strings_intern_len(strings, slices + 6, 3) == binary_id + 1);
+    assert(strings_lookup(strings, "foo") == binary_id + 1);
+    string = strings_lookup_id_len(strings, 2, &len);
+    assert(string && len == 2 && !strcmp(string, "x2"));
+    assert(strings_cursor_seek(&cursor, binary_id));
+    assert(strings_cursor_length(&cursor) == 7);
+    assert(strings_cursor_next(&cursor));
+    assert(strings_cursor_length(&cursor) == 3);
+    assert(!strcmp(strings_cursor_string(&cursor), "foo"));
+
+    // test interning and looking up strings in batches
+    const char *batch[] = {"x1", "batch1", "x2", "batch2", "batch1", "x3",
+                           "123", "batch3"};
+    size_t batch_size = sizeof(batch) / sizeof(*batch);
+    uint32_t batch_ids[8];
+    uint32_t next_id = strings_count(strings) + 1;
+    strings_lookup_batch(strings, batch, NULL, batch_ids, batch_size);
+    assert(batch_ids[0] == 1 && !batch_ids[1] && batch_ids[2] == 2);
+    assert(!batch_ids[3] && !batch_ids[4] && batch_ids[5] == 3);
+    assert(batch_ids[6] == strings_lookup(strings, "123") && !batch_ids[7]);
+    assert(strings_intern_batch(strings, batch, NULL, batch_ids, batch_size));
+    assert(batch_ids[0] == 1 && batch_ids[1] == next_id);
+    assert(batch_ids[2] == 2 && batch_ids[3] == next_id + 1);
+    assert(batch_ids[4] == next_id && batch_ids[5] == 3);
+    assert(batch_ids[6] == strings_intern(strings, "123"));
+    assert(batch_ids[7] == strings_lookup(strings, "batch3"));
+    size_t batch_lens[] = {1, 1, 1, 1, 1, 1, 1, 1};
+    assert(strings_intern_batch(strings, batch, batch_lens, batch_ids,
+                                batch_size));
+    for (size_t i = 0; i < batch_size; i++) {
+        assert(batch_ids[i] == strings_lookup_len(strings, batch[i], 1));
+    }
+    const char **many = malloc(count * sizeof(*many));
+    uint32_t *many_ids = malloc(count * sizeof(*many_ids));
+    assert(many && many_ids);
+    for (unsigned i = 0; i < count; i++) {
+        many[i] = strings_lookup_id(strings, i + 1);
+    }
+    assert(strings_intern_batch(strings, many, NULL, many_ids, count));
+    for (unsigned i = 0; i < count; i++) {
+        assert(many_ids[i] == i + 1);
+    }
+    strings_lookup_batch(strings, many, NULL, many_ids, count);
+    for (unsigned i = 0; i < count; i++) {
+        assert(many_ids[i] == i + 1);
+    }
+    free(many);
+    free(many_ids);
+
+    // test decoding columns of IDs
+    uint32_t column[] = {3, 0, 1, count + 1000, 3, 10};
+    size_t column_size = sizeof(column) / sizeof(*column);
+    uint32_t offsets[7], lens[6];
+    char data[64];
+    assert(strings_decode_column(strings, column, column_size, data,
+                                 sizeof(data), offsets) == column_size);
+    assert(offsets[0] == 0 && offsets[1] == 2 && offsets[2] == 2);
+    assert(offsets[3] == 4 && offsets[4] == 4 && offsets[5] == 6);
+    assert(offsets[6] == 9 && !memcmp(data, "x3x1x3x10", 9));
+    assert(strings_decode_column_len(strings, column, column_size, data,
+                                     sizeof(data), lens) == column_size);
+    assert(lens[0] == 2 && lens[1] == 0 && lens[2] == 2 && lens[3] == 0);
+    assert(lens[4] == 2 && lens[5] == 3 && !memcmp(data, "x3x1x3x10", 9));
+    assert(strings_decode_column(strings, column, column_size, data, 5,
+                                 offsets) == 4);
+    assert(offsets[4] == 4);
+    assert(strings_decode_column(strings, column + 4, 2, data, 4,
+                                 offsets) == 1);
+    assert(offsets[1] == 2 && !memcmp(data, "x3", 2));
+#ifdef INLINE_UNSIGNED
+    column[1] = strings_intern(strings, "4294");
+    column[3] = strings_intern(strings, "0");
+    assert(strings_decode_column(strings, column, column_size, data,
+                                 sizeof(data), offsets) == column_size);
+    assert(offsets[6] == 14 && !memcmp(data, "x34294x10x3x10", 14));
+    assert(strings_decode_column(strings, column, column_size, data, 7,
+                                 offsets) == 2);
+    assert(offsets[2] == 6 && !memcmp(data, "x34294", 6));
+#endif
+
     // test strings larger than the page size
     char *large_string = malloc(PAGE_SIZE + 1);
     assert(large_string);
     memset(large_string, 'x', PAGE_SIZE);
     large_string[PAGE_SIZE] = '\0';
+    uint32_t large_count = strings_count(strings);
     assert(!strings_intern(strings, large_string));
     free(large_string);
+    // a failed intern doesn't leave behind a ref or a hash
+    assert(strings_intern(strings, "after-large") == large_count + 1);
+    assert(!strcmp(strings_lookup_id(strings, large_count + 1),
+                   "after-large"));
 
     strings_free(strings);
 
@@ -166,5 +500,1067 @@ int main() {
     assert(strings_page_size() == PAGE_SIZE);
 
     strings_free(strings);
+
+    // test hash seeds
+    strings = strings_new();
+    assert(strings);
+    assert(strings_hash_seed(strings, 12345));
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+    }
+    assert(!strings_hash_seed(strings, 54321));
+    assert(!strings_hash_key(strings, NULL));
+    assert(!strings_rehash_count(strings));
+
+    strings_free(strings);
+
+    // test keyed hashing
+    const uint8_t key[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14};
+    strings = strings_new();
+    assert(strings);
+    assert(strings_hash_key(strings, key));
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+    }
+    assert(!strings_rehash_count(strings));
+    strings_free(strings);
+    strings = strings_new();
+    assert(strings);
+    assert(strings_hash_key(strings, NULL));
+    assert(strings_intern(strings, "foo") == 1);
+    assert(strings_lookup(strings, "foo") == 1);
+
+    // test that colliding strings trigger a rehash. The pairs "aB" and "b!"
+    // have the same DJB2 hash, and so do all concatenations of them
+#ifdef DJB2_HASH
+    strings_free(strings);
+    strings = strings_new();
+    assert(strings);
+    char colliding[25] = {0};
+    unsigned collisions = 1 << 12;
+    for (unsigned i = 0; i < collisions; i++) {
+        for (unsigned bit = 0; bit < 12; bit++) {
+            memcpy(colliding + bit * 2, i & (1 << bit) ? "aB" : "b!", 2);
+        }
+        assert(strings_intern(strings, colliding) == i + 1);
+    }
+    assert(strings_rehash_count(strings) == 1);
+    for (unsigned i = 0; i < collisions; i++) {
+        for (unsigned bit = 0; bit < 12; bit++) {
+            memcpy(colliding + bit * 2, i & (1 << bit) ? "aB" : "b!", 2);
+        }
+        assert(strings_lookup(strings, colliding) == i + 1);
+        assert(strings_intern(strings, colliding) == i + 1);
+    }
+#endif
+
+    // test that strings which start probing from the same group trigger a
+    // rehash with any hash. The default seed is public, so strings whose
+    // hashes share their low bits can be found by brute force
+    strings_free(strings);
+    strings = strings_new();
+    assert(strings);
+    unsigned flooding = 1200;
+    char (*flood)[16] = malloc(sizeof(*flood) * flooding);
+    assert(flood);
+    for (unsigned i = 0, candidate = 0; i < flooding; candidate++) {
+        snprintf(flood[i], sizeof(*flood), "flood%u", candidate);
+        uint64_t hash = hash_string(flood[i], strlen(flood[i]), 5381);
+        if (!((hash >> 32) & 0xFFF)) {
+            i++;
+        }
+    }
+    for (unsigned i = 0; i < flooding; i++) {
+        assert(strings_intern(strings, flood[i]) == i + 1);
+    }
+    assert(strings_rehash_count(strings) == 1);
+    for (unsigned i = 0; i < flooding; i++) {
+        assert(strings_lookup(strings, flood[i]) == i + 1);
+        assert(!strcmp(strings_lookup_id(strings, i + 1), flood[i]));
+    }
+    free(flood);
+
+    strings_free(strings);
+
+    // test one writer with concurrent readers
+    strings = strings_new();
+    assert(strings);
+    pthread_t readers[4];
+    for (unsigned i = 0; i < 4; i++) {
+        assert(!pthread_create(&readers[i], NULL, concurrent_reader, strings));
+    }
+    buffer[0] = 'y';
+    for (unsigned i = 1; i <= 200000; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        assert(!pthread_join(readers[i], NULL));
+    }
+
+    strings_free(strings);
+
+    // test versions pinned by readers while strings are interned and
+    // restored
+    strings = strings_new();
+    assert(strings);
+    pthread_t version_readers[2];
+    for (unsigned i = 0; i < 2; i++) {
+        assert(!pthread_create(&version_readers[i], NULL, version_reader,
+                               strings));
+    }
+    struct strings_snapshot version_snapshot;
+    for (unsigned i = 1; strings_count(strings) < 100000; i++) {
+        buffer[0] = 'v';
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer));
+        if (i % 100 == 0) {
+            strings_snapshot(strings, &version_snapshot);
+            buffer[0] = 'w';
+            assert(strings_intern(strings, buffer));
+            if (!strings_restore(strings, &version_snapshot)) {
+                assert(strings_lookup(strings, buffer));
+            } else {
+                assert(!strings_lookup(strings, buffer));
+            }
+        }
+    }
+    for (unsigned i = 0; i < 2; i++) {
+        assert(!pthread_join(version_readers[i], NULL));
+    }
+    strings_free(strings);
+
+    // test versions from a single thread
+    strings = strings_new();
+    assert(strings);
+    assert(strings_intern(strings, "foo") == 1);
+    strings_snapshot(strings, &middle_snapshot);
+    struct strings_version *version = strings_version_pin(strings);
+    assert(version);
+    assert(strings_intern(strings, "bar") == 2);
+    assert(strings_version_count(version) == 1);
+    assert(strings_version_lookup(version, "foo") == 1);
+    assert(!strings_version_lookup(version, "bar"));
+    assert(!strings_version_lookup_id(version, 2));
+    assert(!strcmp(strings_version_lookup_id(version, 1), "foo"));
+    string = strings_version_lookup_id_len(version, 1, &len);
+    assert(string && len == 3);
+    assert(strings_restore(strings, &middle_snapshot));
+    assert(!strings_compress(strings, 16));
+    struct strings_version *newer = strings_version_pin(strings);
+    assert(newer && newer != version);
+    assert(strings_intern(strings, "baz") == 2);
+    strings_snapshot(strings, &end_snapshot);
+    assert(strings_intern(strings, "qux") == 3);
+    strings_version_unpin(newer);
+    newer = strings_version_pin(strings);
+    assert(newer && strings_version_count(newer) == 3);
+    assert(!strings_restore(strings, &end_snapshot));
+    assert(strings_lookup(strings, "qux") == 3);
+    strings_version_unpin(newer);
+    assert(strings_restore(strings, &end_snapshot));
+    assert(!strings_lookup(strings, "qux"));
+    assert(strings_restore(strings, &middle_snapshot));
+    assert(strings_count(strings) == 1);
+    assert(!strcmp(strings_version_lookup_id(version, 1), "foo"));
+    strings_version_unpin(version);
+    strings_free(strings);
+
+    // test a sharded repository with many writers
+    assert(!strings_sharded_new(0));
+    struct strings_sharded *sharded = strings_sharded_new(6);
+    assert(sharded);
+    assert(!strings_sharded_count(sharded));
+    assert(!strings_sharded_lookup(sharded, "foo"));
+    assert(!strings_sharded_lookup_id(sharded, 0));
+    assert(!strings_sharded_lookup_id(sharded, 1));
+    static struct sharded_interner interners[4];
+    pthread_t writers[4];
+    for (unsigned i = 0; i < 4; i++) {
+        interners[i].sharded = sharded;
+        interners[i].offset = i * 12345;
+        assert(!pthread_create(&writers[i], NULL, sharded_intern,
+                               &interners[i]));
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        assert(!pthread_join(writers[i], NULL));
+    }
+    assert(strings_sharded_count(sharded) == 50000);
+    buffer[0] = 'z';
+    for (unsigned i = 0; i < 50000; i++) {
+        uint32_t id = interners[0].ids[i];
+        for (unsigned j = 1; j < 4; j++) {
+            assert(interners[j].ids[i] == id);
+        }
+        unsigned_string(buffer + 1, i);
+        assert(strings_sharded_lookup(sharded, buffer) == id);
+        assert(strings_sharded_intern(sharded, buffer) == id);
+        string = strings_sharded_lookup_id(sharded, id);
+        assert(string && !strcmp(string, buffer));
+    }
+    assert(strings_sharded_intern_len(sharded, "a\0b", 3));
+    assert(strings_sharded_lookup_len(sharded, "a\0b", 3));
+    assert(!strings_sharded_lookup_len(sharded, "a\0c", 3));
+    assert(strings_sharded_count(sharded) == 50001);
+    assert(strings_sharded_allocated_bytes(sharded) > 50000 * 6);
+    strings_sharded_free(sharded);
+
+    // test interning from many producers through a queue
+    strings = strings_new();
+    assert(strings);
+    struct strings_queue *queue = strings_queue_new(strings, 64);
+    assert(queue);
+    assert(strings_queue_intern(queue, "foo", 3) == 1);
+    assert(strings_queue_intern(queue, "foo", 3) == 1);
+    static struct queue_producer producers[4];
+    pthread_t producer_threads[4];
+    for (unsigned i = 0; i < 4; i++) {
+        producers[i].queue = queue;
+        producers[i].offset = i * 777;
+        assert(!pthread_create(&producer_threads[i], NULL, queue_produce,
+                               &producers[i]));
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        assert(!pthread_join(producer_threads[i], NULL));
+    }
+    strings_queue_free(queue);
+    assert(strings_count(strings) == 20001);
+    buffer[0] = 'q';
+    for (unsigned i = 0; i < 20000; i++) {
+        uint32_t id = producers[0].ids[i];
+        assert(id > 1 && id <= 20001);
+        for (unsigned j = 1; j < 4; j++) {
+            assert(producers[j].ids[i] == id);
+        }
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == id);
+    }
+    strings_free(strings);
+
+    // test the hot-key cache
+    strings = strings_new();
+    assert(strings);
+    struct strings_cache *cache = strings_cache_new(strings, 100);
+    assert(cache);
+    assert(!strings_cache_lookup(cache, "foo", 3));
+    assert(strings_cache_intern(cache, "foo", 3) == 1);
+    assert(strings_cache_intern(cache, "foo", 3) == 1);
+    assert(strings_cache_lookup(cache, "foo", 3) == 1);
+    assert(strings_cache_get(cache, "foo", 3) == 1);
+    assert(!strings_cache_get(cache, "fo", 2));
+    assert(strings_cache_hits(cache) == 3);
+    assert(strings_cache_misses(cache) == 3);
+    char long_key[100];
+    memset(long_key, 'l', sizeof(long_key));
+    assert(strings_cache_intern(cache, long_key, sizeof(long_key)) == 2);
+    assert(strings_cache_intern(cache, long_key, sizeof(long_key)) == 2);
+    assert(strings_cache_hits(cache) == 3);
+    strings_snapshot(strings, &middle_snapshot);
+    assert(strings_cache_intern(cache, "bar", 3) == 3);
+    assert(strings_cache_get(cache, "bar", 3) == 3);
+    assert(strings_restore(strings, &middle_snapshot));
+    assert(!strings_cache_get(cache, "bar", 3));
+    assert(!strings_cache_get(cache, "foo", 3));
+    assert(strings_cache_intern(cache, "baz", 3) == 3);
+    assert(strings_cache_intern(cache, "bar", 3) == 4);
+    assert(strings_cache_intern(cache, "foo", 3) == 1);
+    strings_cache_put(cache, "qux", 3, 42);
+    assert(strings_cache_get(cache, "qux", 3) == 42);
+    buffer[0] = 'c';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_cache_intern(cache, buffer, strlen(buffer)) == i + 4);
+    }
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_cache_lookup(cache, buffer, strlen(buffer)) == i + 4);
+    }
+    strings_cache_free(cache);
+    strings_free(strings);
+
+    // test saving a repository and mapping it back in
+    strings = strings_new();
+    assert(strings);
+    buffer[0] = 's';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    char path[] = "/tmp/intern-tests-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    assert(strings_save(strings, fd));
+    close(fd);
+    strings_free(strings);
+    assert(!strings_load_mmap("/nonexistent"));
+    strings = strings_load_mmap(path);
+    assert(strings);
+    assert(strings_count(strings) == count);
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+        string = strings_lookup_id(strings, i);
+        assert(string && !strcmp(string, buffer));
+    }
+    strings_snapshot(strings, &middle_snapshot);
+    for (unsigned i = count + 1; i <= count * 2; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    for (unsigned i = 1; i <= count * 2; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+    }
+    assert(strings_restore(strings, &middle_snapshot));
+    assert(strings_count(strings) == count);
+    assert(strings_intern(strings, "foo") == count + 1);
+    strings_free(strings);
+    fd = open(path, O_WRONLY | O_TRUNC);
+    assert(fd >= 0);
+    assert(write(fd, "garbage", 7) == 7);
+    close(fd);
+    assert(!strings_load_mmap(path));
+    unlink(path);
+
+    // test exporting a delta from a primary and importing it into a replica
+    strings = strings_new();
+    assert(strings);
+    struct strings *replica = strings_new();
+    assert(replica);
+    buffer[0] = 'd';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+        assert(strings_intern(replica, buffer) == i);
+    }
+    strings_snapshot(strings, &middle_snapshot);
+    for (unsigned i = count + 1; i <= count * 2; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    char *large = malloc(1000);
+    assert(large);
+    memset(large, 'l', 1000);
+    assert(strings_intern_len(strings, large, 1000) == count * 2 + 1);
+    assert(strings_intern_len(strings, "", 0) == count * 2 + 2);
+    struct delta_buffer delta = {NULL, 0, 0};
+    struct strings_delta_writer delta_writer = {delta_buffer_write, &delta};
+    struct strings_delta_reader delta_reader = {delta_buffer_read, &delta};
+    assert(strings_export_since(strings, &middle_snapshot, &delta_writer));
+    assert(strings_import_delta(replica, &delta_reader));
+    assert(strings_count(replica) == count * 2 + 2);
+    for (unsigned i = 1; i <= count * 2; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(replica, buffer) == i);
+    }
+    assert(strings_lookup_len(replica, large, 1000) == count * 2 + 1);
+    assert(strings_lookup_len(replica, "", 0) == count * 2 + 2);
+    // a delta can't be applied twice, or to a replica in a different state
+    delta.position = 0;
+    assert(!strings_import_delta(replica, &delta_reader));
+    assert(strings_count(replica) == count * 2 + 2);
+    strings_free(replica);
+    replica = strings_new();
+    assert(replica);
+    delta.position = 0;
+    assert(!strings_import_delta(replica, &delta_reader));
+    assert(strings_count(replica) == 0);
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(replica, buffer) == i);
+    }
+    // a truncated or corrupt delta leaves the replica unchanged
+    delta.size--;
+    delta.position = 0;
+    assert(!strings_import_delta(replica, &delta_reader));
+    assert(strings_count(replica) == count);
+    delta.size++;
+    delta.data[delta.size - 1] ^= 1;
+    delta.position = 0;
+    assert(!strings_import_delta(replica, &delta_reader));
+    assert(strings_count(replica) == count);
+    unsigned_string(buffer + 1, count * 2);
+    assert(!strings_lookup(replica, buffer));
+    delta.data[delta.size - 1] ^= 1;
+    // an import isn't started while a version is pinned, since it couldn't
+    // be undone
+    struct strings_version *replica_version = strings_version_pin(replica);
+    assert(replica_version);
+    assert(strings_version_pinned(replica));
+    delta.position = 0;
+    assert(!strings_import_delta(replica, &delta_reader));
+    assert(strings_count(replica) == count);
+    strings_version_unpin(replica_version);
+    assert(!strings_version_pinned(replica));
+    delta.position = 0;
+    assert(strings_import_delta(replica, &delta_reader));
+    assert(strings_lookup(replica, buffer) == count * 2);
+    free(delta.data);
+    free(large);
+    strings_free(replica);
+    strings_free(strings);
+
+    // test a repository in shared memory, which a second mapping (in this
+    // process, and in a child process) sees strings through
+    char name[32];
+    snprintf(name, sizeof(name), "/intern-tests-%d", (int)getpid());
+    assert(!strings_shared_open(name));
+    struct strings_shared *shared = strings_shared_create(name, count,
+                                                          count * 16);
+    assert(shared);
+    assert(!strings_shared_create(name, count, count * 16));
+    struct strings_shared *shared_reader = strings_shared_open(name);
+    assert(shared_reader);
+    assert(!strings_shared_intern(shared_reader, "foo"));
+    buffer[0] = 'm';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_shared_intern(shared, buffer) == i);
+        assert(strings_shared_lookup(shared_reader, buffer) == i);
+    }
+    assert(strings_shared_intern(shared, buffer) == count);
+    assert(!strings_shared_intern(shared, "full"));
+    assert(strings_shared_count(shared_reader) == count);
+    assert(!strings_shared_lookup_id(shared_reader, 0));
+    assert(!strings_shared_lookup_id(shared_reader, count + 1));
+    assert(!strings_shared_lookup(shared_reader, "full"));
+    pid_t child = fork();
+    assert(child >= 0);
+    if (!child) {
+        struct strings_shared *child_reader = strings_shared_open(name);
+        if (!child_reader) {
+            _exit(1);
+        }
+        for (unsigned i = 1; i <= count; i++) {
+            unsigned_string(buffer + 1, i);
+            string = strings_shared_lookup_id(child_reader, i);
+            if (strings_shared_lookup(child_reader, buffer) != i ||
+                    !string || strcmp(string, buffer)) {
+                _exit(1);
+            }
+        }
+        strings_shared_close(child_reader);
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && !WEXITSTATUS(status));
+    strings_shared_close(shared_reader);
+    strings_shared_close(shared);
+    assert(strings_shared_unlink(name));
+    assert(!strings_shared_open(name));
+    shared = strings_shared_create(name, 10, 13);
+    assert(shared);
+    assert(strings_shared_intern(shared, "foo") == 1);
+    assert(!strings_shared_intern(shared, "barbaz"));
+    assert(strings_shared_intern_len(shared, "", 0) == 2);
+    assert(strings_shared_lookup_len(shared, "", 0) == 2);
+    strings_shared_close(shared);
+    assert(strings_shared_unlink(name));
+    // integers are stored rather than inlined, even with INLINE_UNSIGNED
+    shared = strings_shared_create(name, 1, 16);
+    assert(shared);
+    assert(strings_shared_intern(shared, "42") == 1);
+    assert(!strcmp(strings_shared_lookup_id(shared, 1), "42"));
+    strings_shared_close(shared);
+    assert(strings_shared_unlink(name));
+
+    // test a repository whose strings are kept in a file
+    char file_path[] = "/tmp/intern-tests-XXXXXX";
+    fd = mkstemp(file_path);
+    assert(fd >= 0);
+    unlink(file_path);
+    strings = strings_new_file(fd);
+    assert(strings);
+    buffer[0] = 'f';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    strings_snapshot(strings, &middle_snapshot);
+    for (unsigned i = count + 1; i <= count * 2; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    assert(strings_restore(strings, &middle_snapshot));
+    for (unsigned i = count * 2; i > count; i--) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == count * 3 + 1 - i);
+    }
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+        string = strings_lookup_id(strings, i);
+        assert(string && !strcmp(string, buffer));
+    }
+    strings_free(strings);
+
+    // test that file-backed blocks map pages across extents
+    struct block *block = block_new_file(PAGE_SIZE, fd);
+    assert(block);
+    close(fd);
+    size_t extent_pages = block->extent_pages;
+    char *first = block_alloc(block, PAGE_SIZE);
+    assert(first);
+    first[0] = 'a';
+    for (size_t i = 1; i < extent_pages; i++) {
+        assert(block_alloc(block, PAGE_SIZE));
+    }
+    char *next = block_alloc(block, PAGE_SIZE);
+    assert(next && block->extent_count == 2);
+    next[PAGE_SIZE - 1] = 'b';
+    assert(first[0] == 'a' && next[PAGE_SIZE - 1] == 'b');
+    block_free(block);
+
+    // test freezing a repository
+    strings = strings_new();
+    assert(strings);
+    struct strings_frozen *frozen = strings_freeze(strings);
+    assert(frozen);
+    assert(!strings_frozen_count(frozen));
+    assert(!strings_frozen_lookup(frozen, "foo"));
+    assert(!strings_frozen_lookup_id(frozen, 1));
+    strings_frozen_free(frozen);
+    buffer[0] = 'p';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    assert(strings_intern_len(strings, "a\0b", 3) == count + 1);
+    assert(strings_intern_len(strings, "", 0) == count + 2);
+    frozen = strings_freeze(strings);
+    assert(frozen);
+    strings_free(strings);
+    assert(strings_frozen_count(frozen) == count + 2);
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_frozen_lookup(frozen, buffer) == i);
+        string = strings_frozen_lookup_id(frozen, i);
+        assert(string && !strcmp(string, buffer));
+    }
+    buffer[0] = 'q';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(!strings_frozen_lookup(frozen, buffer));
+    }
+    assert(strings_frozen_lookup_len(frozen, "a\0b", 3) == count + 1);
+    assert(!strings_frozen_lookup_len(frozen, "a\0c", 3));
+    assert(strings_frozen_lookup_len(frozen, "", 0) == count + 2);
+    string = strings_frozen_lookup_id_len(frozen, count + 1, &len);
+    assert(string && len == 3 && !memcmp(string, "a\0b", 4));
+    string = strings_frozen_lookup_id_len(frozen, count + 2, &len);
+    assert(string && !len && !*string);
+    assert(!strings_frozen_lookup_id(frozen, 0));
+    assert(!strings_frozen_lookup_id(frozen, count + 3));
+#ifdef INLINE_UNSIGNED
+    assert(strings_frozen_lookup(frozen, "1234") == (1234 | 0x80000000));
+    string = strings_frozen_lookup_id(frozen, 1234 | 0x80000000);
+    assert(string && !strcmp(string, "1234"));
+#endif
+    assert(strings_frozen_allocated_bytes(frozen) < count * 24);
+    strings_frozen_free(frozen);
+    // strings which have the same DJB2 hash (see the rehash test) can still
+    // be frozen, among many random strings
+    strings = strings_new();
+    assert(strings);
+    char frozen_colliding[25] = {0};
+    for (unsigned i = 0; i < 1 << 12; i++) {
+        for (unsigned bit = 0; bit < 12; bit++) {
+            memcpy(frozen_colliding + bit * 2, i & (1 << bit) ? "aB" : "b!",
+                   2);
+        }
+        assert(strings_intern(strings, frozen_colliding) == i + 1);
+    }
+    uint64_t random_state = 1;
+    char random_string[16];
+    while (strings_count(strings) < 200000) {
+        for (unsigned i = 0; i < sizeof(random_string); i++) {
+            random_state = random_state * 6364136223846793005ULL +
+                1442695040888963407ULL;
+            random_string[i] = 'a' + (random_state >> 59);
+        }
+        assert(strings_intern_len(strings, random_string,
+                                  sizeof(random_string)));
+    }
+    frozen = strings_freeze(strings);
+    assert(frozen);
+    for (uint32_t id = 1; id <= strings_count(strings); id++) {
+        string = strings_lookup_id_len(strings, id, &len);
+        assert(strings_frozen_lookup_len(frozen, string, len) == id);
+    }
+    strings_frozen_free(frozen);
+    strings_free(strings);
+
+    // test sorting a repository and finding ranges of IDs
+    strings = strings_new();
+    assert(strings);
+    assert(strings_sorted(strings));
+    assert(strings_intern(strings, "b") == 1);
+    assert(strings_intern(strings, "ba") == 2);
+    assert(strings_sorted(strings));
+    assert(strings_intern(strings, "a") == 3);
+    assert(!strings_sorted(strings));
+    uint32_t lo, hi;
+    assert(!strings_prefix_range(strings, "b", 1, &lo, &hi));
+    buffer[0] = 'r';
+    for (unsigned i = count; i >= 1; i--) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == count - i + 4);
+    }
+    assert(strings_intern_len(strings, "", 0) == count + 4);
+    assert(strings_intern_len(strings, "b\0", 2) == count + 5);
+    uint32_t *remap = malloc(sizeof(*remap) * (count + 6));
+    assert(remap);
+    struct strings *sorted = strings_sort(strings, remap);
+    assert(sorted);
+    assert(strings_sorted(sorted));
+    assert(strings_count(sorted) == count + 5);
+    assert(strings_lookup_len(sorted, "", 0) == 1);
+    assert(strings_lookup(sorted, "a") == 2);
+    assert(strings_lookup(sorted, "b") == 3);
+    assert(strings_lookup_len(sorted, "b\0", 2) == 4);
+    assert(strings_lookup(sorted, "ba") == 5);
+    for (uint32_t id = 1; id <= count + 5; id++) {
+        string = strings_lookup_id(strings, id);
+        const char *sorted_string = strings_lookup_id(sorted, remap[id]);
+        assert(string && sorted_string && !strcmp(string, sorted_string));
+        if (remap[id] > 1) {
+            assert(strcmp(strings_lookup_id(sorted, remap[id] - 1),
+                          sorted_string) <= 0);
+        }
+    }
+    assert(!remap[0]);
+    assert(strings_prefix_range(sorted, "b", 1, &lo, &hi));
+    assert(lo == 3 && hi == 6);
+    assert(strings_prefix_range(sorted, "", 0, &lo, &hi));
+    assert(lo == 1 && hi == count + 6);
+    assert(strings_prefix_range(sorted, "c", 1, &lo, &hi));
+    assert(lo == hi && lo == 6);
+    assert(strings_prefix_range(sorted, "z", 1, &lo, &hi));
+    assert(lo == hi && lo == count + 6);
+    // r1, r10, r100, r1000, r10000, r100000 and the 11 strings of r1xxxx
+    assert(strings_prefix_range(sorted, "r1000", 5, &lo, &hi));
+    assert(hi - lo == 12);
+    string = strings_lookup_id(sorted, lo);
+    assert(string && !strcmp(string, "r1000"));
+    assert(strings_range(sorted, "a", 1, "b", 1, &lo, &hi));
+    assert(lo == 2 && hi == 3);
+    assert(strings_range(sorted, "a", 1, "bb", 2, &lo, &hi));
+    assert(lo == 2 && hi == 6);
+    assert(strings_range(sorted, "r", 1, "r2", 2, &lo, &hi));
+    assert(hi - lo == 11112);
+    assert(strings_range(sorted, "z", 1, "a", 1, &lo, &hi));
+    assert(lo == hi);
+    // interning out of order and restoring
+    strings_snapshot(sorted, &middle_snapshot);
+    assert(strings_intern(sorted, "zz") == count + 6);
+    assert(strings_sorted(sorted));
+    assert(strings_intern(sorted, "c") == count + 7);
+    assert(!strings_sorted(sorted));
+    assert(!strings_range(sorted, "a", 1, "b", 1, &lo, &hi));
+    assert(strings_restore(sorted, &middle_snapshot));
+    assert(strings_sorted(sorted));
+    strings_free(sorted);
+    strings_free(strings);
+    // strings which share a prefix
+    strings = strings_new();
+    assert(strings);
+    assert(strings_intern(strings, "prefix-abc") == 1);
+    assert(strings_intern(strings, "prefix-ab") == 2);
+    assert(strings_intern_len(strings, "prefix-abd\0", 11) == 3);
+    assert(strings_intern(strings, "prefix-abd") == 4);
+    assert(strings_intern(strings, "prefix-abcdefghijklmnop") == 5);
+    assert(strings_intern(strings, "prefix-abcdefghijklmno") == 6);
+    sorted = strings_sort(strings, remap);
+    assert(sorted);
+    assert(remap[1] == 2 && remap[2] == 1 && remap[3] == 6 &&
+           remap[4] == 5 && remap[5] == 4 && remap[6] == 3);
+    assert(strings_prefix_range(sorted, "prefix-abc", 10, &lo, &hi));
+    assert(lo == 2 && hi == 5);
+    free(remap);
+    strings_free(sorted);
+    strings_free(strings);
+
+    // test freezing a repository with front-coded strings
+    strings = strings_new();
+    assert(strings);
+    frozen = strings_freeze_front_coded(strings);
+    assert(frozen);
+    assert(!strings_frozen_lookup(frozen, "foo"));
+    assert(!strings_frozen_lookup_id(frozen, 1));
+    strings_frozen_free(frozen);
+    char long_string[300];
+    memset(long_string, 'x', sizeof(long_string) - 1);
+    long_string[sizeof(long_string) - 1] = '\0';
+    assert(strings_intern(strings, long_string) == 1);
+    long_string[200] = '\0';
+    assert(strings_intern(strings, long_string) == 2);
+    assert(strings_intern_len(strings, "", 0) == 3);
+    assert(strings_intern_len(strings, "a\0b", 3) == 4);
+    char url[32] = "https://example.com/";
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(url + 20, i);
+        assert(strings_intern(strings, url) == i + 4);
+    }
+    sorted = strings_sort(strings, NULL);
+    assert(sorted);
+    strings_free(strings);
+    struct strings_frozen *front_coded = strings_freeze_front_coded(sorted);
+    assert(front_coded);
+    frozen = strings_freeze(sorted);
+    assert(frozen);
+    assert(strings_frozen_count(front_coded) == count + 4);
+    for (uint32_t id = 1; id <= count + 4; id++) {
+        string = strings_lookup_id_len(sorted, id, &len);
+        size_t front_coded_len;
+        const char *front_coded_string =
+            strings_frozen_lookup_id_len(front_coded, id, &front_coded_len);
+        assert(front_coded_string && front_coded_len == len &&
+               !memcmp(front_coded_string, string, len + 1));
+        assert(strings_frozen_lookup_len(front_coded, string, len) == id);
+    }
+    assert(strings_frozen_lookup(front_coded, long_string));
+    long_string[199] = 'y';
+    assert(!strings_frozen_lookup(front_coded, long_string));
+    assert(!strings_frozen_lookup(front_coded, "https://example.com/0"));
+    assert(!strings_frozen_lookup(front_coded, "https://example.com"));
+    assert(!strings_frozen_lookup_len(front_coded, "a\0c", 3));
+    assert(!strings_frozen_lookup_id(front_coded, 0));
+    assert(!strings_frozen_lookup_id(front_coded, count + 5));
+#ifdef INLINE_UNSIGNED
+    assert(strings_frozen_lookup(front_coded, "1234") == (1234 | 0x80000000));
+    string = strings_frozen_lookup_id(front_coded, 1234 | 0x80000000);
+    assert(string && !strcmp(string, "1234"));
+#endif
+    assert(strings_frozen_allocated_bytes(front_coded) <
+           strings_frozen_allocated_bytes(frozen) * 3 / 4);
+    strings_frozen_free(front_coded);
+    strings_frozen_free(frozen);
+    strings_free(sorted);
+
+    // test freezing a repository with tail-merged strings
+    strings = strings_new();
+    assert(strings);
+    frozen = strings_freeze_tail_merged(strings);
+    assert(frozen);
+    assert(!strings_frozen_lookup(frozen, "foo"));
+    assert(!strings_frozen_merged_bytes(frozen));
+    strings_frozen_free(frozen);
+    assert(strings_intern(strings, "com") == 1);
+    assert(strings_intern(strings, "www.example.com") == 2);
+    assert(strings_intern(strings, "example.com") == 3);
+    assert(strings_intern(strings, "mail.example.com") == 4);
+    assert(strings_intern_len(strings, "a\0com", 5) == 5);
+    assert(strings_intern(strings, "/usr/bin/ls") == 6);
+    assert(strings_intern(strings, "ls") == 7);
+    assert(strings_intern(strings, "bin/ls") == 8);
+    assert(strings_intern_len(strings, "", 0) == 9);
+    frozen = strings_freeze_tail_merged(strings);
+    assert(frozen);
+    // com, example.com, ls, bin/ls and the empty string
+    assert(strings_frozen_merged_bytes(frozen) == 4 + 12 + 3 + 7 + 1);
+    for (uint32_t id = 1; id <= 9; id++) {
+        string = strings_lookup_id_len(strings, id, &len);
+        size_t merged_len;
+        const char *merged_string = strings_frozen_lookup_id_len(frozen, id,
+                                                                 &merged_len);
+        assert(merged_string && merged_len == len &&
+               !memcmp(merged_string, string, len + 1));
+        assert(strings_frozen_lookup_len(frozen, string, len) == id);
+    }
+    assert(!strings_frozen_lookup(frozen, "xample.com"));
+    assert(!strings_frozen_lookup(frozen, "s"));
+    assert(!strings_frozen_lookup_len(frozen, "a\0co", 4));
+    assert(!strings_frozen_lookup_id(frozen, 10));
+    strings_frozen_free(frozen);
+    strings_free(strings);
+    strings = strings_new();
+    assert(strings);
+    assert(strings_intern(strings, "example.org") == 1);
+    memcpy(url, "host", 4);
+    for (unsigned i = 1; i <= count; i++) {
+        size_t digits = unsigned_string(url + 4, i);
+        memcpy(url + 4 + digits, ".example.org", 13);
+        assert(strings_intern(strings, url) == 2 * i);
+        assert(strings_intern(strings, url + 2) == 2 * i + 1);
+    }
+    frozen = strings_freeze(strings);
+    assert(frozen);
+    struct strings_frozen *merged = strings_freeze_tail_merged(strings);
+    assert(merged);
+    for (uint32_t id = 1; id <= strings_count(strings); id++) {
+        string = strings_lookup_id(strings, id);
+        assert(!strcmp(strings_frozen_lookup_id(merged, id), string));
+        assert(strings_frozen_lookup(merged, string) == id);
+    }
+    assert(strings_frozen_merged_bytes(merged));
+    assert(strings_frozen_allocated_bytes(merged) +
+           strings_frozen_merged_bytes(merged) ==
+           strings_frozen_allocated_bytes(frozen));
+    strings_frozen_free(merged);
+    strings_frozen_free(frozen);
+    strings_free(strings);
+
+    // test compressing string pages
+    strings = strings_new();
+    assert(strings);
+    assert(!strings_compressed(strings));
+    struct strings_snapshot empty_snapshot;
+    strings_snapshot(strings, &empty_snapshot);
+    buffer[0] = 'c';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    size_t uncompressed_bytes = strings_allocated_bytes(strings);
+    assert(!strings_compress(strings, 15));
+    assert(strings_compress(strings, 16));
+    assert(!strings_compress(strings, 16));
+    assert(strings_compressed(strings));
+    assert(strings_compressed_pages(strings));
+    // the cache has 16 pages, and there's a page to compress into
+    assert(strings_allocated_bytes(strings) - 17 * strings_page_size() <
+           uncompressed_bytes);
+    strings_snapshot(strings, &middle_snapshot);
+    for (unsigned i = count + 1; i <= count * 2; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    for (unsigned i = 1; i <= count * 2; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+        string = strings_lookup_id_len(strings, i, &len);
+        assert(string && len == strlen(buffer) && !strcmp(string, buffer));
+    }
+    assert(!strings_lookup(strings, "c0"));
+    uint32_t compressed_column[] = {count, 1, count * 2, 2, count + 1};
+    char compressed_data[64];
+    uint32_t compressed_offsets[6];
+    assert(strings_decode_column(strings, compressed_column, 5,
+                                 compressed_data, sizeof(compressed_data),
+                                 compressed_offsets) == 5);
+    assert(!memcmp(compressed_data + compressed_offsets[1], "c1c", 3));
+    // a batch whose first string is on the least recently used page, and
+    // whose other strings are on pages that aren't cached, so reading them
+    // evicts every other page
+    uint32_t stride = count * 2 / 32;
+    assert(strings_lookup_id(strings, 1));
+    for (unsigned i = 1; i < 16; i++) {
+        assert(strings_lookup_id(strings, 1 + stride * i));
+    }
+    uint32_t lru_column[16] = {2};
+    for (unsigned i = 1; i < 16; i++) {
+        lru_column[i] = 1 + stride * (i + 15);
+    }
+    char lru_data[16 * 8];
+    uint32_t lru_offsets[17];
+    assert(strings_decode_column(strings, lru_column, 16, lru_data,
+                                 sizeof(lru_data), lru_offsets) == 16);
+    for (unsigned i = 0; i < 16; i++) {
+        unsigned_string(buffer + 1, lru_column[i]);
+        assert(lru_offsets[i + 1] - lru_offsets[i] == strlen(buffer));
+        assert(!memcmp(lru_data + lru_offsets[i], buffer, strlen(buffer)));
+    }
+    struct strings_cursor compressed_cursor;
+    strings_cursor_init(&compressed_cursor, strings);
+    for (unsigned i = 1; strings_cursor_next(&compressed_cursor); i++) {
+        unsigned_string(buffer + 1, i);
+        assert(!strcmp(strings_cursor_string(&compressed_cursor), buffer));
+        assert(strings_cursor_length(&compressed_cursor) == strlen(buffer));
+    }
+    assert(!strings_sort(strings, NULL));
+    assert(!strings_freeze_tail_merged(strings));
+    frozen = strings_freeze_front_coded(strings);
+    assert(frozen);
+    assert(strings_frozen_lookup(frozen, "c1234") == 1234);
+    strings_frozen_free(frozen);
+    // restoring to a point within a compressed page
+    assert(strings_restore(strings, &middle_snapshot));
+    assert(strings_count(strings) == count);
+    assert(strings_intern(strings, "foo") == count + 1);
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+    }
+    assert(strings_restore(strings, &empty_snapshot));
+    assert(!strings_count(strings));
+    assert(!strings_compressed_pages(strings));
+    assert(strings_intern(strings, "foo") == 1);
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i + 1);
+    }
+    assert(strings_compressed_pages(strings));
+    // saving and loading decompresses pages
+    char compressed_path[] = "/tmp/intern-tests-XXXXXX";
+    fd = mkstemp(compressed_path);
+    assert(fd >= 0);
+    assert(strings_save(strings, fd));
+    close(fd);
+    strings_free(strings);
+    strings = strings_load_mmap(compressed_path);
+    assert(strings);
+    unlink(compressed_path);
+    assert(strings_compress(strings, 16));
+    assert(!strings_compressed_pages(strings));
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i + 1);
+    }
+    strings_free(strings);
+    // a string stays valid while the pages after it fill up, as long as
+    // fewer pages than the cache holds are compressed
+    strings = strings_new();
+    assert(strings);
+    assert(strings_compress(strings, 16));
+    for (unsigned i = 1; i <= 10; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    string = strings_lookup_id(strings, 10);
+    assert(string);
+    for (unsigned i = 11; strings_compressed_pages(strings) < 15; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    assert(!strcmp(string, "c10"));
+    strings_free(strings);
+    char scratch_path[] = "/tmp/intern-tests-XXXXXX";
+    fd = mkstemp(scratch_path);
+    assert(fd >= 0);
+    strings = strings_new_file(fd);
+    close(fd);
+    unlink(scratch_path);
+    assert(strings);
+    assert(!strings_compress(strings, 16));
+    strings_free(strings);
+
+    // test strings either side of the length that's stored in index slots
+    strings = strings_new();
+    assert(strings);
+    char short_key[40];
+    for (size_t i = 0; i < sizeof(short_key); i++) {
+        short_key[i] = i % 3 ? 'k' : '\0';
+    }
+    for (size_t i = 0; i <= sizeof(short_key); i++) {
+        assert(strings_intern_len(strings, short_key, i) == i + 1);
+    }
+    for (size_t i = 0; i <= sizeof(short_key); i++) {
+        assert(strings_lookup_len(strings, short_key, i) == i + 1);
+        string = strings_lookup_id_len(strings, i + 1, &len);
+        assert(string && len == i && !memcmp(string, short_key, i));
+    }
+    short_key[14] = 'x';
+    short_key[15] = 'x';
+    assert(!strings_lookup_len(strings, short_key, 15));
+    assert(!strings_lookup_len(strings, short_key, 16));
+    assert(strings_lookup_len(strings, short_key, 14) == 15);
+    strings_free(strings);
+
+    // test 64-bit IDs, which inline short strings and integers
+    strings = strings_new();
+    assert(strings);
+    const char *inlined[] = {
+        "", "a", "abcdefg", "0", "123", "-5", "-0", "007", "+5",
+        "4611686018427387903", "-4611686018427387904"
+    };
+    uint64_t id64;
+    for (size_t i = 0; i < sizeof(inlined) / sizeof(*inlined); i++) {
+        id64 = strings_intern64(strings, inlined[i]);
+        assert(id64 > UINT32_MAX);
+        assert(strings_lookup64(strings, inlined[i]) == id64);
+        string = strings_lookup_id64_len(strings, id64, &len);
+        assert(string && len == strlen(inlined[i]));
+        assert(!strcmp(string, inlined[i]));
+    }
+    assert(!strings_count(strings));
+    assert(strings_intern64_len(strings, "a\0b", 3) > UINT32_MAX);
+    string = strings_lookup_id64_len(strings,
+                                     strings_lookup64_len(strings, "a\0b", 3),
+                                     &len);
+    assert(string && len == 3 && !memcmp(string, "a\0b", 3));
+    assert(strings_intern64(strings, "123") !=
+           strings_intern64(strings, "-123"));
+    assert(strings_intern64(strings, "-1") !=
+           strings_intern64_len(strings, "-1", 3));
+    const char *stored[] = {
+        "abcdefgh", "4611686018427387904", "-4611686018427387905",
+        "-0123456", "99999999999999999999", "18446744073709551615",
+        "-9223372036854775808"
+    };
+    for (size_t i = 0; i < sizeof(stored) / sizeof(*stored); i++) {
+        assert(!strings_lookup64(strings, stored[i]));
+        id64 = strings_intern64(strings, stored[i]);
+        assert(id64 == i + 1);
+        assert(strings_lookup(strings, stored[i]) == id64);
+        assert(!strcmp(strings_lookup_id64(strings, id64), stored[i]));
+    }
+    assert(strings_count(strings) == 7);
+    assert(!strings_lookup_id64(strings, 0));
+    assert(!strings_lookup_id64(strings, 8));
+    assert(!strings_lookup_id64(strings, 1ULL << 32 | 1));
+    strings_free(strings);
+
+    // test that repeated small restores don't grow the table, including
+    // restores while the table is growing
+    strings = strings_new();
+    assert(strings);
+    buffer[0] = 'x';
+    for (unsigned i = 1; i <= count; i++) {
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == i);
+    }
+    strings_snapshot(strings, &middle_snapshot);
+    size_t restored_bytes = strings_allocated_bytes(strings);
+    for (unsigned round = 0; round < 1000; round++) {
+        for (unsigned i = 1; i <= 100; i++) {
+            buffer[0] = 'y';
+            unsigned_string(buffer + 1, round * 100 + i);
+            assert(strings_intern(strings, buffer) == count + i);
+        }
+        assert(strings_restore(strings, &middle_snapshot));
+        assert(strings_count(strings) == count);
+    }
+    assert(strings_allocated_bytes(strings) <= restored_bytes);
+    for (unsigned i = 1; i <= count; i++) {
+        buffer[0] = 'x';
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+        buffer[0] = 'y';
+        assert(!strings_lookup(strings, buffer));
+    }
+    unsigned rewound = 0;
+    for (unsigned i = 1; i <= count; i++) {
+        if (i % 1000 == 1) {
+            strings_snapshot(strings, &end_snapshot);
+        }
+        buffer[0] = 'z';
+        unsigned_string(buffer + 1, i);
+        assert(strings_intern(strings, buffer) == count + i);
+        if (i % 1000 == 500 && rewound < i) {
+            assert(strings_restore(strings, &end_snapshot));
+            rewound = i;
+            i -= 500;
+        }
+    }
+    for (unsigned i = 1; i <= count; i++) {
+        buffer[0] = 'x';
+        unsigned_string(buffer + 1, i);
+        assert(strings_lookup(strings, buffer) == i);
+        buffer[0] = 'z';
+        assert(strings_lookup(strings, buffer) == count + i);
+    }
+    strings_free(strings);
+
     return 0;
 }
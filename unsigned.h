@@ -1,3 +1,6 @@
+#ifndef INTERN_UNSIGNED_H_
+#define INTERN_UNSIGNED_H_
+
 static const char digit_pairs[201] = {
     "00010203040506070809"
     "10111213141516171819"
@@ -11,12 +14,12 @@ static const char digit_pairs[201] = {
     "90919293949596979899"
 };
 
-static void unsigned_string(char *dest, uint32_t num)
+static size_t unsigned_string(char *dest, uint32_t num)
 {
     if (!num) {
         dest[0] = '0';
         dest[1] = '\0';
-        return;
+        return 1;
     }
 
     int size;
@@ -41,4 +44,32 @@ static void unsigned_string(char *dest, uint32_t num)
         *c-- = '0' + (num % 10);
         num /= 10;
     }
+    return size;
 }
+
+static inline size_t unsigned64_string(char *dest, uint64_t num)
+{
+    if (num <= UINT32_MAX) {
+        return unsigned_string(dest, (uint32_t)num);
+    }
+
+    // Digits are written backwards into a scratch buffer, and then copied
+    char digits[20];
+    char *c = &digits[sizeof(digits)];
+    while (num >= 100) {
+        int pos = num % 100;
+        num /= 100;
+        c -= 2;
+        memcpy(c, digit_pairs + 2 * pos, 2);
+    }
+    while (num) {
+        *--c = '0' + (num % 10);
+        num /= 10;
+    }
+    size_t size = &digits[sizeof(digits)] - c;
+    memcpy(dest, c, size);
+    dest[size] = '\0';
+    return size;
+}
+
+#endif